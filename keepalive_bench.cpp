@@ -0,0 +1,378 @@
+// keepalive_bench.cpp
+// 热点路径微基准（含时间轮），不依赖 Windows，Linux 上也能编译运行：
+//   g++ -std=c++17 -O2 -pthread keepalive_bench.cpp -o keepalive_bench
+//   cl keepalive_bench.cpp /Fe:keepalive_bench.exe /std:c++17 /O2 /EHsc
+//
+// 用法：keepalive_bench [--json out.json] [--compare baseline.json] [--threshold 10] [--filter substr]
+// 每个用例先标定单次批量（至少 1 ms），预热 3 批，再测 31 批，报告每次操作的中位数与 p99（纳秒）。
+// --compare 时中位数比基线慢超过 threshold% 的用例记为回归，进程返回 2。
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "keepalive_core.h"
+#include "keepalive_timer.h"
+#include "keepalive_util.h"
+
+// ===== 基准框架 =====
+struct BenchResult {
+    std::string name;
+    uint64_t iterations;   // 每批次数
+    int runs;
+    double median_ns;
+    double p99_ns;
+};
+
+static const int BENCH_WARMUP = 3;
+static const int BENCH_RUNS = 31;
+static const double BENCH_MIN_BATCH_NS = 1e6;
+
+static volatile uint64_t g_sink = 0;   // 防止被优化掉
+
+typedef std::function<uint64_t(uint64_t)> BenchOp;   // 执行 n 次，返回任意校验值
+
+static double time_batch(const BenchOp& op, uint64_t n) {
+    auto t0 = std::chrono::steady_clock::now();
+    g_sink += op(n);
+    auto t1 = std::chrono::steady_clock::now();
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+}
+
+static BenchResult run_bench(const std::string& name, const BenchOp& op) {
+    uint64_t n = 1;
+    while (time_batch(op, n) < BENCH_MIN_BATCH_NS && n < (1ull << 30)) n *= 2;
+    for (int i = 0; i < BENCH_WARMUP; i++) time_batch(op, n);
+
+    std::vector<double> per_op;
+    for (int i = 0; i < BENCH_RUNS; i++) per_op.push_back(time_batch(op, n) / (double)n);
+    std::sort(per_op.begin(), per_op.end());
+
+    BenchResult r;
+    r.name = name;
+    r.iterations = n;
+    r.runs = BENCH_RUNS;
+    r.median_ns = per_op[per_op.size() / 2];
+    size_t rank = (size_t)(0.99 * per_op.size() + 0.999999);
+    r.p99_ns = per_op[(rank ? rank : 1) - 1];
+    return r;
+}
+
+// ===== 用例 =====
+static size_t current_time_portable(wchar_t* buf) {
+    time_t now = time(NULL);
+    struct tm lt;
+#ifdef _WIN32
+    localtime_s(&lt, &now);
+#else
+    localtime_r(&now, &lt);
+#endif
+    LogTimestamp t = { lt.tm_year + 1900, lt.tm_mon + 1, lt.tm_mday, lt.tm_hour, lt.tm_min, lt.tm_sec };
+    return format_log_timestamp(buf, t);
+}
+
+// 大约 n 字节的设备名样式 UTF-8 文本，ASCII 与中文混合
+static std::string sample_utf8(size_t n) {
+    static const char* parts[] = { "Headphones (", "\xE8\x80\xB3\xE6\x9C\xBA", " Soundcore Life Q30", ") " };
+    std::string s;
+    for (size_t i = 0; s.size() < n; i++) s += parts[i % 4];
+    s.resize(n);
+    while (!s.empty() && ((unsigned char)s.back() & 0xC0) == 0x80) s.pop_back();
+    if (!s.empty() && (unsigned char)s.back() >= 0xC0) s.pop_back();
+    return s;
+}
+
+static std::vector<std::wstring> sample_blocklist(int n) {
+    std::vector<std::wstring> list;
+    for (int i = 0; i < n; i++) list.push_back(L"Blocked Device " + std::to_wstring(i));
+    return list;
+}
+
+static std::vector<std::string> g_temp_files;
+
+static std::string write_block_file(int n) {
+    std::string path = "keepalive_bench_blocked_" + std::to_string(n) + ".txt";
+    g_temp_files.push_back(path);
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return path;
+    fputs("\xEF\xBB\xBF", f);
+    for (int i = 0; i < n; i++) fprintf(f, "  Blocked Device %d \xE8\x80\xB3\xE6\x9C\xBA\r\n", i);
+    fclose(f);
+    return path;
+}
+
+// 通知线程把事件交给主循环：make_device_event + EventQueue::push，再唤醒主循环；
+// 主循环 drain 到预留好的批量缓冲，处理完回应。唤醒用条件变量代替主程序的事件对象。每次操作是一个事件。
+struct DispatchPingPong {
+    EventQueue queue;
+    std::mutex m;
+    std::condition_variable cv;
+    bool pending = false;
+    uint64_t handled = 0;
+    bool stop = false;
+    std::thread consumer;
+
+    DispatchPingPong() : queue(256) {   // 与 keepalive_log 的 EVENT_QUEUE_CAPACITY 相同
+        consumer = std::thread([this] {
+            std::vector<DeviceEvent> batch;
+            batch.reserve(queue.capacity());
+            std::unique_lock<std::mutex> lk(m);
+            while (true) {
+                cv.wait(lk, [this] { return stop || pending; });
+                if (stop) break;
+                pending = false;
+                lk.unlock();
+                queue.drain(batch);
+                size_t n = batch.size();
+                batch.clear();
+                lk.lock();
+                handled += n;
+                cv.notify_all();
+            }
+        });
+    }
+    ~DispatchPingPong() {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            stop = true;
+        }
+        cv.notify_all();
+        consumer.join();
+    }
+    // 每轮投递 burst 个事件，等全部处理完
+    uint64_t run(uint64_t n, int burst) {
+        static const wchar_t id[] = L"{0.0.0.00000000}.{3f1b5e6a-9c2d-4e7f-8a1b-2c3d4e5f6a7b}";
+        uint64_t sent = 0;
+        while (sent < n) {
+            uint64_t target;
+            {
+                std::lock_guard<std::mutex> lk(m);
+                target = handled;
+            }
+            for (int i = 0; i < burst && sent < n; i++, sent++, target++)
+                queue.push(make_device_event((int64_t)sent, EV_STATE_CHANGED, id, DEVICE_STATE_ACTIVE_VALUE));
+            std::unique_lock<std::mutex> lk(m);
+            pending = true;
+            cv.notify_all();
+            cv.wait(lk, [&] { return handled >= target; });
+        }
+        return handled;
+    }
+};
+
+// 常驻 count 个定时器的时间轮，到期时间在 [now, now + span_ms) 内均匀分布
+struct TimerBench {
+    TimerWheel wheel;
+    std::vector<TimerNode> nodes;
+    int64_t now = 0;
+    int64_t span_ms;
+    uint64_t rng = 0x74696d6572ull;
+    size_t next = 0;
+
+    TimerBench(size_t count, int64_t span) : nodes(count), span_ms(span) {
+        for (TimerNode& n : nodes) wheel.add(&n, random_deadline());
+    }
+    int64_t random_deadline() {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return now + 1 + (int64_t)(rng % (uint64_t)span_ms);
+    }
+    // 取消一个常驻定时器，再以新的到期时间插回去
+    uint64_t insert_cancel(uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            TimerNode& t = nodes[next++ % nodes.size()];
+            wheel.remove(&t);
+            wheel.add(&t, random_deadline());
+        }
+        return wheel.size();
+    }
+    // 推进时间直到触发 n 个，触发的立即以新的到期时间插回，保持常驻数量不变
+    uint64_t expire(uint64_t n) {
+        uint64_t fired = 0;
+        while (fired < n) {
+            now = wheel.next_deadline();
+            fired += wheel.advance(now, [this](TimerNode* t) { wheel.add(t, random_deadline()); });
+        }
+        return fired;
+    }
+};
+
+static void register_cases(std::vector<std::pair<std::string, BenchOp>>& cases) {
+    static const std::wstring device = L"Headphones (Soundcore Life Q30 \x8033\x673A)";
+    for (int n : { 1, 16, 256 }) {
+        auto list = std::make_shared<std::vector<std::wstring>>(sample_blocklist(n));
+        cases.push_back({ "is_blocked_device/" + std::to_string(n), [list](uint64_t iters) {
+            uint64_t hits = 0;
+            for (uint64_t i = 0; i < iters; i++) hits += is_blocked_device(device.c_str(), *list);
+            return hits;
+        } });
+    }
+    for (int n : { 16, 256, 4096 }) {
+        std::string path = write_block_file(n);
+        cases.push_back({ "read_blocked_devices/" + std::to_string(n), [path](uint64_t iters) {
+            uint64_t total = 0;
+            for (uint64_t i = 0; i < iters; i++) total += read_blocked_devices(path.c_str()).size();
+            return total;
+        } });
+    }
+    for (int n : { 16, 256, 4096 }) {
+        auto text = std::make_shared<std::string>(sample_utf8(n));
+        cases.push_back({ "utf8_to_wstring/" + std::to_string(n), [text](uint64_t iters) {
+            uint64_t total = 0;
+            for (uint64_t i = 0; i < iters; i++) total += utf8_to_wstring(*text).size();
+            return total;
+        } });
+    }
+    cases.push_back({ "current_time", [](uint64_t iters) {
+        uint64_t total = 0;
+        wchar_t buf[LOG_TIMESTAMP_LEN + 1];
+        for (uint64_t i = 0; i < iters; i++) total += current_time_portable(buf) + buf[20];
+        return total;
+    } });
+    // write_log 的格式化部分：时间戳 + 消息拼进定长 LogText，再由日志线程转 UTF-8 追加到批量缓冲
+    for (int n : { 16, 128 }) {
+        auto msg = std::make_shared<std::wstring>(utf8_to_wstring("Device changed -> " + sample_utf8(n)));
+        cases.push_back({ "write_log_format/" + std::to_string(n), [msg](uint64_t iters) {
+            std::string batch;
+            uint64_t total = 0;
+            for (uint64_t i = 0; i < iters; i++) {
+                LogText line;
+                wchar_t ts[LOG_TIMESTAMP_LEN + 1];
+                line.append(ts, current_time_portable(ts)) << msg->c_str();
+                append_utf8(batch, line.c_str(), line.size());
+                batch += "\r\n";
+                if ((i & 63) == 63) {
+                    total += batch.size();
+                    batch.clear();
+                }
+            }
+            return total + batch.size();
+        } });
+    }
+    for (int burst : { 1, 16 }) {
+        cases.push_back({ "event_dispatch/" + std::to_string(burst), [burst](uint64_t iters) {
+            static DispatchPingPong d;
+            return d.run(iters, burst);
+        } });
+    }
+    // 10k 个定时器常驻：重试/防抖一类的短定时器（10 s 内）和探测/上报一类的长定时器（1 h 内）
+    for (int64_t span : { 10000, 3600000 }) {
+        std::string suffix = span < 60000 ? "/10k_10s" : "/10k_1h";
+        auto bench = std::make_shared<TimerBench>(10000, span);
+        cases.push_back({ "timer_insert_cancel" + suffix, [bench](uint64_t iters) { return bench->insert_cancel(iters); } });
+        cases.push_back({ "timer_expire" + suffix, [bench](uint64_t iters) { return bench->expire(iters); } });
+    }
+}
+
+// ===== JSON 输出与基线比较 =====
+static bool write_json(const char* path, const std::vector<BenchResult>& results) {
+    FILE* f = fopen(path, "wb");
+    if (!f) return false;
+    fprintf(f, "{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"runs\": %d, \"iterations\": %llu, \"median_ns\": %.3f, \"p99_ns\": %.3f}%s\n",
+                r.name.c_str(), r.runs, (unsigned long long)r.iterations, r.median_ns, r.p99_ns,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    return true;
+}
+
+// 只认本程序写出的格式："name": "...", ... "median_ns": <数字>
+static std::map<std::string, double> read_baseline(const char* path) {
+    std::map<std::string, double> out;
+    FILE* f = fopen(path, "rb");
+    if (!f) return out;
+    std::string text;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) text.append(buf, n);
+    fclose(f);
+
+    size_t pos = 0;
+    while ((pos = text.find("\"name\": \"", pos)) != std::string::npos) {
+        pos += 9;
+        size_t end = text.find('"', pos);
+        if (end == std::string::npos) break;
+        std::string name = text.substr(pos, end - pos);
+        size_t m = text.find("\"median_ns\": ", end);
+        size_t next = text.find("\"name\": \"", end);
+        if (m == std::string::npos || (next != std::string::npos && m > next)) continue;
+        out[name] = atof(text.c_str() + m + 13);
+        pos = end;
+    }
+    return out;
+}
+
+int main(int argc, char** argv) {
+    const char* json_path = nullptr;
+    const char* compare_path = nullptr;
+    const char* filter = nullptr;
+    double threshold = 10.0;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--json" && i + 1 < argc) json_path = argv[++i];
+        else if (a == "--compare" && i + 1 < argc) compare_path = argv[++i];
+        else if (a == "--threshold" && i + 1 < argc) threshold = atof(argv[++i]);
+        else if (a == "--filter" && i + 1 < argc) filter = argv[++i];
+        else {
+            fprintf(stderr, "usage: %s [--json out.json] [--compare baseline.json] [--threshold pct] [--filter substr]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::map<std::string, double> baseline;
+    if (compare_path) {
+        baseline = read_baseline(compare_path);
+        if (baseline.empty()) {
+            fprintf(stderr, "cannot read baseline %s\n", compare_path);
+            return 1;
+        }
+    }
+
+    std::vector<std::pair<std::string, BenchOp>> cases;
+    register_cases(cases);
+
+    std::vector<BenchResult> results;
+    int regressions = 0;
+    printf("%-28s %12s %12s %12s\n", "benchmark", "median_ns", "p99_ns", compare_path ? "vs_base" : "");
+    for (const auto& c : cases) {
+        if (filter && c.first.find(filter) == std::string::npos) continue;
+        BenchResult r = run_bench(c.first, c.second);
+        results.push_back(r);
+        printf("%-28s %12.1f %12.1f", r.name.c_str(), r.median_ns, r.p99_ns);
+        auto it = baseline.find(r.name);
+        if (it != baseline.end() && it->second > 0) {
+            double delta = (r.median_ns / it->second - 1.0) * 100.0;
+            bool regressed = delta > threshold;
+            regressions += regressed;
+            printf(" %+11.1f%%%s", delta, regressed ? "  REGRESSION" : "");
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+    for (const auto& f : g_temp_files) remove(f.c_str());
+
+    if (json_path && !write_json(json_path, results)) {
+        fprintf(stderr, "cannot write %s\n", json_path);
+        return 1;
+    }
+    if (regressions > 0) {
+        printf("%d regression(s) above %.1f%%\n", regressions, threshold);
+        return 2;
+    }
+    return 0;
+}
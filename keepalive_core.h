@@ -0,0 +1,894 @@
+// keepalive_core.h
+// 不依赖 Windows 的保活决策逻辑。时间一律由调用方传入（毫秒），方便在 Linux 上用假时钟驱动。
+#ifndef KEEPALIVE_CORE_H
+#define KEEPALIVE_CORE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <wchar.h>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "keepalive_util.h"
+
+// ===== 播放流健康检测 =====
+// 调用方定期探测一次，告诉检测器流是否在前进（音频时钟位置增加，或会话处于活动状态）。
+// 单次没前进记一次 underrun；连续 stall_probes 次没前进判定为卡死，需要重启播放。
+// 刚开始播放的 grace_ms 内引擎可能还没把会话切到活动状态，不做判定。
+class StallDetector {
+public:
+    enum Verdict {
+        HEALTHY = 0,
+        SUSPECT = 1,
+        STALLED = 2
+    };
+
+    struct Config {
+        int64_t grace_ms = 3000;
+        int stall_probes = 2;
+    };
+
+    StallDetector() {}
+    explicit StallDetector(const Config& cfg) : cfg_(cfg) {}
+
+    // 每次（重新）开始播放时调用
+    void reset(int64_t now_ms) {
+        started_ms_ = now_ms;
+        misses_ = 0;
+        armed_ = true;
+    }
+
+    // 停止播放后不再判定
+    void disarm() { armed_ = false; }
+
+    Verdict observe(int64_t now_ms, bool progressed) {
+        if (!armed_ || now_ms - started_ms_ < cfg_.grace_ms) return HEALTHY;
+        if (progressed) {
+            misses_ = 0;
+            return HEALTHY;
+        }
+        underruns_++;
+        if (++misses_ < cfg_.stall_probes) return SUSPECT;
+        stalls_++;
+        armed_ = false;   // 等调用方重启后 reset()
+        return STALLED;
+    }
+
+    uint64_t underruns() const { return underruns_; }
+    uint64_t stalls() const { return stalls_; }
+
+private:
+    Config cfg_;
+    int64_t started_ms_ = 0;
+    int misses_ = 0;
+    bool armed_ = false;
+    uint64_t underruns_ = 0;
+    uint64_t stalls_ = 0;
+};
+
+// ===== 其他音频检测 =====
+// 别的程序正在往保活设备上放声音时，静音流只是多一路混音输入和一个唤醒源。调用方每 probe_ms
+// 探测一次：默认设备上其他会话里最大的峰值电平（0~1）和处于活动状态的会话数。连续 active_probes 次
+// 不低于 on_level 就暂停保活。别的会话全部停下时它们的流已经关了，马上恢复；还有活动会话时流还开着，
+// 设备不会休眠，要连续 quiet_ms 都低于 off_level 才恢复。两个门限和恢复前的等待避免曲间空白、
+// 淡入淡出、一声提示音就来回开关流。
+class OtherAudioDetector {
+public:
+    struct Config {
+        int64_t probe_ms = 2000;
+        float on_level = 0.001f;     // 约 -60 dBFS
+        float off_level = 0.0003f;   // 约 -70 dBFS
+        int active_probes = 2;
+        int64_t quiet_ms = 8000;
+    };
+
+    OtherAudioDetector() {}
+    explicit OtherAudioDetector(const Config& cfg) : cfg_(cfg) {}
+
+    // 返回是否应当暂停保活。探测失败时调用方传 0 和 0，宁可多放静音
+    bool observe(int64_t now_ms, float peak, int sessions) {
+        if (!paused_) {
+            if (peak < cfg_.on_level) {
+                loud_ = 0;
+            } else if (++loud_ >= cfg_.active_probes) {
+                paused_ = true;
+                quiet_since_ms_ = -1;
+                pauses_++;
+            }
+        } else if (peak >= cfg_.off_level) {
+            quiet_since_ms_ = -1;
+        } else {
+            if (quiet_since_ms_ < 0) quiet_since_ms_ = now_ms;
+            if (sessions == 0 || now_ms - quiet_since_ms_ >= cfg_.quiet_ms) {
+                paused_ = false;
+                loud_ = 0;
+                resumes_++;
+            }
+        }
+        return paused_;
+    }
+
+    // 换了设备，重新开始判断
+    void reset() {
+        paused_ = false;
+        loud_ = 0;
+        quiet_since_ms_ = -1;
+    }
+
+    bool paused() const { return paused_; }
+    uint64_t pauses() const { return pauses_; }
+    uint64_t resumes() const { return resumes_; }
+    const Config& config() const { return cfg_; }
+
+private:
+    Config cfg_;
+    bool paused_ = false;
+    int loud_ = 0;
+    int64_t quiet_since_ms_ = -1;
+    uint64_t pauses_ = 0;
+    uint64_t resumes_ = 0;
+};
+
+// ===== 设备事件 =====
+// IMMNotificationClient 回调的可移植表示。字符串是定长数组，入队出队不做堆分配。
+enum DeviceEventType {
+    EV_DEFAULT_CHANGED = 1,     // id/name 为新的默认播放设备，id 为空表示没有默认设备
+    EV_ADDED = 2,
+    EV_REMOVED = 3,
+    EV_STATE_CHANGED = 4,       // state 为 DEVICE_STATE_* 取值
+    EV_PROPERTY_CHANGED = 5
+};
+
+static const uint32_t DEVICE_STATE_ACTIVE_VALUE = 1;   // 与 DEVICE_STATE_ACTIVE 相同
+static const size_t DEVICE_ID_LEN = 128;
+static const size_t DEVICE_NAME_LEN = 256;
+
+struct DeviceEvent {
+    int64_t t_us;
+    uint32_t type;
+    uint32_t state;
+    wchar_t id[DEVICE_ID_LEN];
+    wchar_t name[DEVICE_NAME_LEN];
+};
+
+inline void copy_wfield(wchar_t* dst, size_t n, const wchar_t* src) {
+    size_t i = 0;
+    if (src)
+        for (; i + 1 < n && src[i]; i++) dst[i] = src[i];
+    dst[i] = 0;
+}
+
+inline DeviceEvent make_device_event(int64_t t_us, uint32_t type, const wchar_t* id,
+                                     uint32_t state = 0, const wchar_t* name = nullptr) {
+    DeviceEvent e;
+    e.t_us = t_us;
+    e.type = type;
+    e.state = state;
+    copy_wfield(e.id, DEVICE_ID_LEN, id);
+    copy_wfield(e.name, DEVICE_NAME_LEN, name);
+    return e;
+}
+
+// ===== 事件队列 =====
+// 多个回调线程投递、主循环一次取空的有界队列。满了丢弃新事件并置溢出标志，
+// 主循环看到溢出后应重新查询默认设备，不依赖丢失的事件。
+class EventQueue {
+public:
+    explicit EventQueue(size_t capacity) : ring_(capacity) {}
+
+    bool push(const DeviceEvent& e) {
+        std::lock_guard<std::mutex> lk(m_);
+        if (count_ == ring_.size()) {
+            dropped_++;
+            overflow_ = true;
+            return false;
+        }
+        ring_[(head_ + count_) % ring_.size()] = e;
+        count_++;
+        if (count_ > high_water_) high_water_ = count_;
+        return true;
+    }
+
+    // 追加到 out（调用方预留容量即可避免分配），返回期间是否发生过溢出
+    bool drain(std::vector<DeviceEvent>& out) {
+        std::lock_guard<std::mutex> lk(m_);
+        for (size_t i = 0; i < count_; i++) out.push_back(ring_[(head_ + i) % ring_.size()]);
+        head_ = (head_ + count_) % ring_.size();
+        count_ = 0;
+        bool overflow = overflow_;
+        overflow_ = false;
+        return overflow;
+    }
+
+    size_t capacity() const { return ring_.size(); }
+    size_t high_water() {
+        std::lock_guard<std::mutex> lk(m_);
+        return high_water_;
+    }
+    uint64_t dropped() {
+        std::lock_guard<std::mutex> lk(m_);
+        return dropped_;
+    }
+
+private:
+    std::mutex m_;
+    std::vector<DeviceEvent> ring_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+    size_t high_water_ = 0;
+    uint64_t dropped_ = 0;
+    bool overflow_ = false;
+};
+
+// ===== 保活决策 =====
+// 只在主循环线程使用。跟踪当前默认播放设备及其状态，决定何时停止/重新开始静音播放：
+// 默认设备变化、默认设备本身被移除或状态变化时需要重启；其他设备的通知不影响播放。
+class KeepAliveCore {
+public:
+    struct Action {
+        bool stop;
+        bool start;
+    };
+
+    explicit KeepAliveCore(const std::vector<std::wstring>* blocked) : blocked_(blocked) {}
+
+    void set_default(const wchar_t* id, const wchar_t* name) {
+        if (wcscmp(id, default_id_) != 0) paused_ = false;   // 新设备上有没有别的声音还不知道
+        copy_wfield(default_id_, DEVICE_ID_LEN, id);
+        copy_wfield(default_name_, DEVICE_NAME_LEN, name);
+        default_active_ = default_id_[0] != 0;
+    }
+
+    void apply(const DeviceEvent& e) {
+        switch (e.type) {
+        case EV_DEFAULT_CHANGED:
+            set_default(e.id, e.name);
+            pending_ = true;
+            break;
+        case EV_REMOVED:
+            if (is_default(e.id)) {
+                default_active_ = false;
+                pending_ = true;
+            }
+            break;
+        case EV_STATE_CHANGED:
+            if (is_default(e.id)) {
+                default_active_ = e.state == DEVICE_STATE_ACTIVE_VALUE;
+                pending_ = true;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    // 健康探测判定卡死等情况，不依赖设备通知强制重启
+    void force_restart() { pending_ = true; }
+    bool pending() const { return pending_; }
+
+    bool blocked() const { return default_id_[0] && blocked_ && is_blocked_device(default_name_, *blocked_); }
+    bool should_play() const { return default_active_ && !blocked() && !paused_; }
+
+    // 别的程序正在往默认设备放声音时暂停保活，变化时需要重新决策。换了默认设备自动取消暂停
+    void set_paused(bool paused) {
+        if (paused == paused_) return;
+        paused_ = paused;
+        pending_ = true;
+    }
+    bool paused() const { return paused_; }
+
+    // 取走挂起的重启；调用方执行动作后用 set_playing() 回报实际结果
+    Action decide() {
+        Action a = { false, false };
+        if (!pending_) return a;
+        pending_ = false;
+        a.stop = playing_;
+        a.start = should_play();
+        return a;
+    }
+
+    void set_playing(bool playing) { playing_ = playing; }
+    bool playing() const { return playing_; }
+    bool default_active() const { return default_active_; }
+    const wchar_t* default_id() const { return default_id_; }
+    const wchar_t* default_name() const { return default_name_; }
+
+    // --pause-on-audio 每次探测调用。换默认设备时 set_default 已经取消了暂停，检测器跟着重新开始；
+    // 再按探测结果暂停或恢复。返回探测后是否暂停
+    bool apply_other_audio(OtherAudioDetector& det, int64_t now_ms, float peak, int sessions) {
+        if (!paused_ && det.paused()) det.reset();
+        set_paused(det.observe(now_ms, peak, sessions));
+        return paused_;
+    }
+
+private:
+    bool is_default(const wchar_t* id) const {
+        return !id[0] || wcscmp(id, default_id_) == 0;   // 不知道是哪个设备时按默认设备处理
+    }
+
+    const std::vector<std::wstring>* blocked_;
+    wchar_t default_id_[DEVICE_ID_LEN] = {};
+    wchar_t default_name_[DEVICE_NAME_LEN] = {};
+    bool default_active_ = false;
+    bool pending_ = false;
+    bool playing_ = false;
+    bool paused_ = false;
+};
+
+// ===== 启动重试 =====
+// 带抖动的指数退避：第 n 次重试（从 0 开始）的基准间隔为 base * 2^n，封顶 cap，
+// 实际取 [d/2, d] 里的随机值，避免多个设备或多个进程同一时刻重试。
+// 随机数用 xorshift64，种子由调用方给，仿真结果可复现。
+class Backoff {
+public:
+    struct Config {
+        int64_t base_ms = 25;
+        int64_t cap_ms = 30000;
+    };
+
+    Backoff() {}
+    explicit Backoff(const Config& cfg, uint64_t seed = 0x9e3779b97f4a7c15ull) : cfg_(cfg), rng_(seed ? seed : 1) {}
+
+    int64_t delay(uint32_t attempt) {
+        int64_t d = cfg_.base_ms;
+        for (uint32_t i = 0; i < attempt && d < cfg_.cap_ms; i++) d *= 2;
+        if (d > cfg_.cap_ms) d = cfg_.cap_ms;
+        int64_t half = d / 2;
+        return half + (int64_t)(next() % (uint64_t)(d - half + 1));
+    }
+
+    const Config& config() const { return cfg_; }
+
+private:
+    uint64_t next() {
+        rng_ ^= rng_ << 13;
+        rng_ ^= rng_ >> 7;
+        rng_ ^= rng_ << 17;
+        return rng_;
+    }
+
+    Config cfg_;
+    uint64_t rng_ = 0x9e3779b97f4a7c15ull;
+};
+
+// 每个设备连续启动失败的次数，用来决定重试从第几级退避开始：刚连上的蓝牙设备偶尔失败一两次，
+// 几十毫秒内就能重试成功；一直失败的设备重连后不会又从最短间隔开始反复打扰音频引擎。
+// 成功清零，距上次失败超过 forget_ms 也清零。定长表，满了替换最久没失败过的设备，不做堆分配。
+class FailureStreaks {
+public:
+    static const size_t SLOTS = 16;
+
+    explicit FailureStreaks(int64_t forget_ms = 600000) : forget_ms_(forget_ms) {}
+
+    uint32_t get(const wchar_t* id, int64_t now_ms) const {
+        const Entry* e = find(id);
+        return e && now_ms - e->last_ms <= forget_ms_ ? e->streak : 0;
+    }
+
+    // 记一次失败，返回包括这次在内的连续失败次数
+    uint32_t fail(const wchar_t* id, int64_t now_ms) {
+        Entry* e = find(id);
+        if (!e) {
+            e = &slots_[0];
+            for (size_t i = 1; i < SLOTS; i++)
+                if (!slots_[i].id[0] || (e->id[0] && slots_[i].last_ms < e->last_ms)) e = &slots_[i];
+            copy_wfield(e->id, DEVICE_ID_LEN, id);
+            e->streak = 0;
+        } else if (now_ms - e->last_ms > forget_ms_) {
+            e->streak = 0;
+        }
+        e->last_ms = now_ms;
+        return ++e->streak;
+    }
+
+    void succeed(const wchar_t* id) {
+        Entry* e = find(id);
+        if (e) e->streak = 0;
+    }
+
+private:
+    struct Entry {
+        wchar_t id[DEVICE_ID_LEN];
+        uint32_t streak;
+        int64_t last_ms;
+    };
+
+    const Entry* find(const wchar_t* id) const {
+        for (size_t i = 0; i < SLOTS; i++)
+            if (slots_[i].id[0] && wcscmp(slots_[i].id, id) == 0) return &slots_[i];
+        return nullptr;
+    }
+    Entry* find(const wchar_t* id) { return const_cast<Entry*>(static_cast<const FailureStreaks*>(this)->find(id)); }
+
+    int64_t forget_ms_;
+    Entry slots_[SLOTS] = {};
+};
+
+// ===== 间歇保活 =====
+// 接收端在 idle_timeout 内收不到音频才会休眠。间歇模式只在快到超时前播放 burst 长的静音，
+// 其余时间把流完全关掉，音频引擎和蓝牙链路不必一直忙着。
+// 两次 burst 之间的静默 gap = idle_timeout - margin，margin 取超时的 1/5、至少 2 s，
+// 覆盖定时误差和打开流的耗时。超时太短、gap 还不如一个 burst 长时退回持续播放。
+static const int64_t DUTY_DEFAULT_BURST_MS = 1000;
+static const int64_t DUTY_MIN_MARGIN_MS = 2000;
+
+struct DutyCyclePlan {
+    int64_t idle_timeout_ms = 0;
+    int64_t burst_ms = 0;
+    int64_t gap_ms = 0;   // 0 表示持续播放
+
+    bool enabled() const { return gap_ms > 0; }
+};
+
+inline DutyCyclePlan plan_duty_cycle(int64_t idle_timeout_ms, int64_t burst_ms = 0) {
+    DutyCyclePlan p;
+    p.idle_timeout_ms = idle_timeout_ms;
+    p.burst_ms = burst_ms > 0 ? burst_ms : DUTY_DEFAULT_BURST_MS;
+    int64_t margin = idle_timeout_ms / 5;
+    if (margin < DUTY_MIN_MARGIN_MS) margin = DUTY_MIN_MARGIN_MS;
+    int64_t gap = idle_timeout_ms - margin;
+    p.gap_ms = gap >= p.burst_ms ? gap : 0;
+    return p;
+}
+
+// 按计划交替开关流。下一次开流从上一次关流算起，而不是从实际醒来的时刻算，晚醒的误差不会累积。
+// 开流时距上次关流已经超过 idle_timeout，说明接收端可能已经休眠，记一次 miss。
+class BurstSchedule {
+public:
+    BurstSchedule() {}
+    explicit BurstSchedule(const DutyCyclePlan& plan) : plan_(plan) {}
+
+    // burst 开始（流已打开）
+    void opened(int64_t now_ms) {
+        if (closed_ms_ >= 0 && now_ms - closed_ms_ > plan_.idle_timeout_ms) misses_++;
+        open_ = true;
+        bursts_++;
+        next_ms_ = now_ms + plan_.burst_ms;
+    }
+
+    // burst 结束（流已关闭）
+    void closed(int64_t now_ms) {
+        open_ = false;
+        closed_ms_ = now_ms;
+        next_ms_ = now_ms + plan_.gap_ms;
+    }
+
+    // 之后的 burst/gap 按新计划，已经排好的下一步不变
+    void set_plan(const DutyCyclePlan& plan) { plan_ = plan; }
+
+    bool open() const { return open_; }
+    int64_t next_ms() const { return next_ms_; }   // 下一次该关流（open）或开流（!open）的时间
+    uint64_t bursts() const { return bursts_; }
+    uint64_t misses() const { return misses_; }
+    const DutyCyclePlan& plan() const { return plan_; }
+
+private:
+    DutyCyclePlan plan_;
+    bool open_ = false;
+    int64_t next_ms_ = 0;
+    int64_t closed_ms_ = -1;
+    uint64_t bursts_ = 0;
+    uint64_t misses_ = 0;
+};
+
+// 流打开的时间占总时间的比例，持续播放时接近 1
+class DutyCycleMeter {
+public:
+    explicit DutyCycleMeter(int64_t start_ms = 0) : start_ms_(start_ms) {}
+
+    void set_active(bool active, int64_t now_ms) {
+        if (active == active_) return;
+        if (active) since_ms_ = now_ms;
+        else active_ms_ += now_ms - since_ms_;
+        active_ = active;
+    }
+
+    bool active() const { return active_; }
+    int64_t active_ms(int64_t now_ms) const { return active_ms_ + (active_ ? now_ms - since_ms_ : 0); }
+    double ratio(int64_t now_ms) const {
+        int64_t span = now_ms - start_ms_;
+        return span > 0 ? (double)active_ms(now_ms) / (double)span : 0.0;
+    }
+
+private:
+    int64_t start_ms_;
+    bool active_ = false;
+    int64_t since_ms_ = 0;
+    int64_t active_ms_ = 0;
+};
+
+// ===== 空闲超时学习 =====
+// 配置为 auto 的设备不知道接收端多久没音频会休眠，就逐步加长静默去试：静默之后设备还在，这段静默
+// 就是安全的；静默期间（或重新开流后 GRACE_MS 内）设备断开，说明超时不比这段静默长。
+// 还没碰到上界时每次加长一半，碰到后在安全值和上界之间二分，差距不超过 1 s 或安全值的 1/10 时收敛，
+// 之后按安全值做间歇保活（plan_duty_cycle 再留余量）。
+// 比已知安全值还短的静默就断开，多半是用户自己关了耳机：学习中忽略，收敛后连续两次才重新学习。
+#define IDLE_TIMEOUT_MAGIC 0x54494B41u   // "AKIT"
+
+// 持久化的定长记录，整数均为小端；文件就是记录数组
+struct IdleTimeoutRecord {
+    uint32_t magic;
+    uint32_t flags;            // IDLE_TIMEOUT_CONVERGED
+    char endpoint_id[64];      // UTF-8
+    int64_t safe_ms;
+    int64_t limit_ms;
+    uint32_t strikes;
+    uint32_t probes;
+    uint32_t failures;
+    uint32_t reserved;
+};
+static_assert(sizeof(IdleTimeoutRecord) == 104, "idle timeout record layout changed");
+static const uint32_t IDLE_TIMEOUT_CONVERGED = 1;
+
+class IdleTimeoutLearner {
+public:
+    static const int64_t START_MS = 5000;
+    static const int64_t MAX_MS = 600000;     // 静默十分钟还不断开就当作不会休眠
+    static const int64_t RESOLUTION_MS = 1000;
+    static const int64_t GRACE_MS = 3000;     // 重新开流后这段时间内断开，算在上一段静默头上
+    static const uint32_t RELEARN_STRIKES = 2;
+
+    IdleTimeoutLearner() {}
+
+    bool converged() const { return converged_; }
+    int64_t safe_ms() const { return safe_ms_; }     // 设备挺过的最长静默
+    int64_t limit_ms() const { return limit_ms_; }   // 设备没挺过的最短静默，0 表示还没碰到
+    uint32_t probes() const { return probes_; }
+    uint32_t failures() const { return failures_; }
+
+    // 学习中：下一段要试的静默
+    int64_t next_probe_ms() const {
+        if (limit_ms_) return (safe_ms_ + limit_ms_) / 2;
+        int64_t g = safe_ms_ ? safe_ms_ + safe_ms_ / 2 : START_MS;
+        return g < MAX_MS ? g : MAX_MS;
+    }
+
+    // 收敛后按安全值留余量；学习中 gap 就是下一段试探，不统计 miss
+    DutyCyclePlan plan(int64_t burst_ms = 0) const {
+        if (converged_) return plan_duty_cycle(safe_ms_, burst_ms);
+        DutyCyclePlan p;
+        p.idle_timeout_ms = INT64_MAX;
+        p.burst_ms = burst_ms > 0 ? burst_ms : DUTY_DEFAULT_BURST_MS;
+        p.gap_ms = next_probe_ms();
+        return p;
+    }
+
+    // 关流，开始一段静默
+    void gap_started(int64_t now_ms) {
+        settle(now_ms);
+        in_gap_ = true;
+        closed_ms_ = now_ms;
+    }
+
+    // 静默结束，流重新打开；这段静默过了 GRACE_MS 才算挺过
+    // 上一段还在 GRACE_MS 内（burst 加静默比它还短）时两段合并取长的，GRACE_MS 从上一段算起
+    void gap_ended(int64_t now_ms) {
+        settle(now_ms);
+        if (!in_gap_) return;
+        in_gap_ = false;
+        int64_t silence = now_ms - closed_ms_;
+        if (!pending_ms_) reopened_ms_ = now_ms;
+        if (silence > pending_ms_) pending_ms_ = silence;
+        if (!converged_) {
+            probes_++;
+            dirty_ = true;
+        }
+    }
+
+    // 设备断开或不再活动。返回 true 表示算作一次超时
+    bool device_lost(int64_t now_ms) {
+        int64_t silence = 0;
+        if (pending_ms_ && now_ms - reopened_ms_ < GRACE_MS) silence = pending_ms_;
+        else if (in_gap_) silence = now_ms - closed_ms_;
+        settle(now_ms);
+        in_gap_ = false;
+        pending_ms_ = 0;
+        return silence > 0 && failed(silence);
+    }
+
+    // 有变化需要保存时返回 true 并清除标记
+    bool take_dirty() {
+        bool d = dirty_;
+        dirty_ = false;
+        return d;
+    }
+
+    void save(IdleTimeoutRecord& r) const {
+        r.magic = IDLE_TIMEOUT_MAGIC;
+        r.flags = converged_ ? IDLE_TIMEOUT_CONVERGED : 0;
+        r.safe_ms = safe_ms_;
+        r.limit_ms = limit_ms_;
+        r.strikes = strikes_;
+        r.probes = probes_;
+        r.failures = failures_;
+        r.reserved = 0;
+    }
+
+    bool load(const IdleTimeoutRecord& r) {
+        if (r.magic != IDLE_TIMEOUT_MAGIC || r.safe_ms < 0 || r.limit_ms < 0) return false;
+        converged_ = (r.flags & IDLE_TIMEOUT_CONVERGED) != 0;
+        safe_ms_ = r.safe_ms;
+        limit_ms_ = r.limit_ms;
+        strikes_ = r.strikes;
+        probes_ = r.probes;
+        failures_ = r.failures;
+        return true;
+    }
+
+private:
+    void settle(int64_t now_ms) {
+        if (pending_ms_ && now_ms - reopened_ms_ >= GRACE_MS) {
+            survived(pending_ms_);
+            pending_ms_ = 0;
+        }
+    }
+
+    // 收敛后每段静默都比安全值短，不改变状态，也就不用保存
+    void survived(int64_t silence) {
+        int64_t safe = safe_ms_, limit = limit_ms_;
+        uint32_t strikes = strikes_;
+        bool converged = converged_;
+        if (silence > safe_ms_) safe_ms_ = silence;
+        if (limit_ms_ && safe_ms_ >= limit_ms_) limit_ms_ = 0;   // 之前的断开不是超时
+        strikes_ = 0;
+        update();
+        if (safe != safe_ms_ || limit != limit_ms_ || strikes != strikes_ || converged != converged_) dirty_ = true;
+    }
+
+    bool failed(int64_t silence) {
+        dirty_ = true;
+        if (silence <= safe_ms_) {
+            if (!converged_ || ++strikes_ < RELEARN_STRIKES) return false;
+            converged_ = false;   // 接收端的超时变短了（换了固件、换了设备）
+            safe_ms_ = 0;
+            strikes_ = 0;
+        }
+        failures_++;
+        if (!limit_ms_ || silence < limit_ms_) limit_ms_ = silence;
+        update();
+        return true;
+    }
+
+    void update() {
+        if (converged_) return;
+        int64_t tol = safe_ms_ / 10 > RESOLUTION_MS ? safe_ms_ / 10 : RESOLUTION_MS;
+        if (safe_ms_ >= MAX_MS || (limit_ms_ && limit_ms_ - safe_ms_ <= tol)) converged_ = true;
+    }
+
+    int64_t safe_ms_ = 0;
+    int64_t limit_ms_ = 0;
+    bool converged_ = false;
+    uint32_t strikes_ = 0;
+    uint32_t probes_ = 0;
+    uint32_t failures_ = 0;
+    bool in_gap_ = false;
+    int64_t closed_ms_ = 0;
+    int64_t pending_ms_ = 0;   // 最近一段还没过 GRACE_MS 的静默
+    int64_t reopened_ms_ = 0;
+    bool dirty_ = false;
+};
+
+// ===== 先建后拆切换 =====
+// 换默认设备时先在新 endpoint 上开流并开始播放，成功后才释放旧 endpoint 上的流。两个蓝牙设备之间切换时
+// 任何时刻都至少有一路流在放，旧设备不会在新流准备好之前断流；新流开不起来时旧流保持不动，交给调用方重试。
+// Backend 提供 Stream open(const wchar_t* id)（激活、协商格式、初始化并开始播放，失败返回空）、
+// void close(Stream) 和 int64_t now_us()。keepalive_log 用 WASAPI 实现，keepalive_sim 用模拟后端。
+template <typename Backend>
+class StreamHandover {
+public:
+    typedef typename Backend::Stream Stream;
+
+    explicit StreamHandover(const Backend& backend = Backend()) : b_(backend) {}
+    StreamHandover(const StreamHandover&) = delete;
+    StreamHandover& operator=(const StreamHandover&) = delete;
+
+    // 在 id 上开一路新流。原来有流就在新流开始播放后释放，同一个 endpoint 也一样（卡住后重建）。
+    // 失败返回 false，原来的流不动
+    bool play(const wchar_t* id) {
+        int64_t t0 = b_.now_us();
+        Stream s = b_.open(id);
+        if (!s) return false;
+        int64_t started = b_.now_us();
+        bool handover = cur_ && wcscmp(id, id_) != 0;
+        if (cur_) b_.close(cur_);
+        cur_ = s;
+        copy_wfield(id_, DEVICE_ID_LEN, id);
+        if (handover) {
+            handovers_++;
+            last_setup_us_ = started - t0;
+            last_overlap_us_ = b_.now_us() - started;
+        }
+        return true;
+    }
+
+    void stop() {
+        if (!cur_) return;
+        b_.close(cur_);
+        cur_ = Stream();
+        id_[0] = 0;
+    }
+
+    bool playing() const { return cur_ ? true : false; }
+    const wchar_t* id() const { return id_; }
+    Stream stream() const { return cur_; }
+    Backend& backend() { return b_; }
+
+    // 换到另一个 endpoint 的次数；最近一次切换新流从开始打开到出声的时长（新设备一侧的等待）、
+    // 新流出声后旧流又放了多久才释放（旧设备一侧，两路重叠的时长，不会是负数）
+    uint64_t handovers() const { return handovers_; }
+    int64_t last_setup_us() const { return last_setup_us_; }
+    int64_t last_overlap_us() const { return last_overlap_us_; }
+
+private:
+    Backend b_;
+    Stream cur_ = Stream();
+    wchar_t id_[DEVICE_ID_LEN] = {};
+    uint64_t handovers_ = 0;
+    int64_t last_setup_us_ = 0;
+    int64_t last_overlap_us_ = 0;
+};
+
+// ===== 流配置缓存 =====
+// 蓝牙耳机一小时能重连好几次，每次开流都要重新问一遍混音格式和设备周期。按 endpoint ID 缓存协商结果
+// （混音格式的原始字节和据设备周期选定的缓冲时长），重连时直接拿来初始化。最近用过的排在最前，
+// 条目数超过 max_entries 或总占用超过 max_bytes 就淘汰最久没用的。用缓存的格式初始化失败时
+// （用户在声音设置里改了格式）调用方 reject_hit() 后重新协商。用缓存的格式初始化成功后调用方 confirm_hit()，
+// 这时才记一次命中，并把该条目当初协商花的时间记为省下的时间；失败的命中记为未命中。
+class StreamConfigPool {
+public:
+    static const size_t FORMAT_MAX = 256;   // 比这大的格式不缓存
+
+    struct Config {
+        size_t max_entries = 16;
+        size_t max_bytes = 8192;
+    };
+
+    struct Entry {
+        std::wstring id;
+        std::vector<uint8_t> format;
+        int64_t buffer_hns;
+        int64_t negotiate_us;   // 未命中时协商花的时间
+
+        size_t bytes() const { return sizeof(Entry) + id.size() * sizeof(wchar_t) + format.size(); }
+    };
+
+    StreamConfigPool() {}
+    explicit StreamConfigPool(const Config& cfg) : cfg_(cfg) {}
+
+    // 找到时移到最前并返回条目（下一次修改前有效），这时还不算命中；找不到记一次未命中，返回空
+    const Entry* get(const wchar_t* id) {
+        size_t i = find(id);
+        if (i == entries_.size()) {
+            misses_++;
+            return nullptr;
+        }
+        if (i) std::rotate(entries_.begin(), entries_.begin() + i, entries_.begin() + i + 1);
+        return &entries_[0];
+    }
+
+    void put(const wchar_t* id, const void* format, size_t len, int64_t buffer_hns, int64_t negotiate_us) {
+        erase(id);
+        if (!cfg_.max_entries || len > FORMAT_MAX) return;
+        Entry e;
+        e.id = id;
+        e.format.assign((const uint8_t*)format, (const uint8_t*)format + len);
+        e.buffer_hns = buffer_hns;
+        e.negotiate_us = negotiate_us;
+        if (e.bytes() > cfg_.max_bytes) return;
+        bytes_ += e.bytes();
+        entries_.insert(entries_.begin(), std::move(e));
+        while (entries_.size() > cfg_.max_entries || bytes_ > cfg_.max_bytes) {
+            bytes_ -= entries_.back().bytes();
+            entries_.pop_back();
+            evictions_++;
+        }
+    }
+
+    // get() 拿到的格式初始化成功
+    void confirm_hit(const wchar_t* id) {
+        size_t i = find(id);
+        if (i == entries_.size()) return;
+        hits_++;
+        saved_us_ += entries_[i].negotiate_us;
+    }
+
+    // get() 拿到的格式初始化失败：丢掉条目，这次查找记为未命中
+    void reject_hit(const wchar_t* id) {
+        erase(id);
+        misses_++;
+    }
+
+    void erase(const wchar_t* id) {
+        size_t i = find(id);
+        if (i == entries_.size()) return;
+        bytes_ -= entries_[i].bytes();
+        entries_.erase(entries_.begin() + i);
+    }
+
+    size_t size() const { return entries_.size(); }
+    size_t bytes() const { return bytes_; }
+    const Entry& at(size_t i) const { return entries_[i]; }   // 0 是最近用过的
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+    uint64_t evictions() const { return evictions_; }
+    int64_t saved_us() const { return saved_us_; }
+    const Config& config() const { return cfg_; }
+
+private:
+    size_t find(const wchar_t* id) const {
+        size_t i = 0;
+        while (i < entries_.size() && entries_[i].id != id) i++;
+        return i;
+    }
+
+    Config cfg_;
+    std::vector<Entry> entries_;
+    size_t bytes_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t evictions_ = 0;
+    int64_t saved_us_ = 0;
+};
+
+// ===== 事件记录文件 =====
+// "KAEV" + 版本号，之后每条记录：int64 t_us, u8 type, u32 state, u16 id_len, u16 name_len,
+// 再跟 UTF-16LE 的 id 和 name。整数均为小端。
+static const char EVENT_TRACE_MAGIC[4] = { 'K', 'A', 'E', 'V' };
+static const uint32_t EVENT_TRACE_VERSION = 1;
+
+inline void put_le(std::string& out, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) out.push_back((char)((v >> (8 * i)) & 0xFF));
+}
+
+inline uint64_t get_le(const unsigned char* p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+inline void append_event_trace_header(std::string& out) {
+    out.append(EVENT_TRACE_MAGIC, 4);
+    put_le(out, EVENT_TRACE_VERSION, 4);
+}
+
+inline void append_event_record(std::string& out, const DeviceEvent& e) {
+    size_t id_len = wcslen(e.id), name_len = wcslen(e.name);
+    put_le(out, (uint64_t)e.t_us, 8);
+    put_le(out, e.type, 1);
+    put_le(out, e.state, 4);
+    put_le(out, id_len, 2);
+    put_le(out, name_len, 2);
+    for (size_t i = 0; i < id_len; i++) put_le(out, (uint16_t)e.id[i], 2);
+    for (size_t i = 0; i < name_len; i++) put_le(out, (uint16_t)e.name[i], 2);
+}
+
+// 文件尾部不完整的记录（进程被直接结束时）忽略
+inline bool parse_event_trace(const std::string& data, std::vector<DeviceEvent>& out) {
+    if (data.size() < 8 || memcmp(data.data(), EVENT_TRACE_MAGIC, 4) != 0) return false;
+    const unsigned char* p = (const unsigned char*)data.data();
+    if (get_le(p + 4, 4) != EVENT_TRACE_VERSION) return false;
+    size_t pos = 8;
+    while (pos + 17 <= data.size()) {
+        size_t id_len = (size_t)get_le(p + pos + 13, 2);
+        size_t name_len = (size_t)get_le(p + pos + 15, 2);
+        if (pos + 17 + 2 * (id_len + name_len) > data.size()) break;
+        DeviceEvent e;
+        e.t_us = (int64_t)get_le(p + pos, 8);
+        e.type = (uint32_t)get_le(p + pos + 8, 1);
+        e.state = (uint32_t)get_le(p + pos + 9, 4);
+        pos += 17;
+        size_t i;
+        for (i = 0; i < id_len && i + 1 < DEVICE_ID_LEN; i++) e.id[i] = (wchar_t)get_le(p + pos + 2 * i, 2);
+        e.id[i] = 0;
+        pos += 2 * id_len;
+        for (i = 0; i < name_len && i + 1 < DEVICE_NAME_LEN; i++) e.name[i] = (wchar_t)get_le(p + pos + 2 * i, 2);
+        e.name[i] = 0;
+        pos += 2 * name_len;
+        out.push_back(e);
+    }
+    return true;
+}
+
+#endif
@@ -1,16 +1,27 @@
 // keepalive_log.cpp
-#include <io.h>
-#include <fcntl.h>
 #include <initguid.h>
 #include <mmdeviceapi.h>
+#include <audioclient.h>
+#include <audiopolicy.h>
+#include <endpointvolume.h>
 #include <windows.h>
 #include <mmsystem.h>
 #include <Functiondiscoverykeys_devpkey.h>
 #include <propvarutil.h>
+#include <shellapi.h>
+#include <psapi.h>
 #include <vector>
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstring>
+#include <atomic>
+#include <cstdarg>
 
 DEFINE_GUID(CLSID_MMDeviceEnumerator,
 0xbcde0395, 0xe52f, 0x467c, 0x8e, 0x3d, 0xc4, 0x57, 0x92, 0x91, 0x69, 0x2e);
@@ -20,8 +31,14 @@ DEFINE_GUID(CLSID_MMDeviceEnumerator,
 #pragma comment(lib, "propsys.lib")
 #pragma comment(lib, "uuid.lib")
 #pragma comment(lib, "user32.lib")
+#pragma comment(lib, "shell32.lib")
+#pragma comment(lib, "psapi.lib")
 
-#include "wav_data_msvc.h"
+#include "keepalive_stats.h"
+#include "keepalive_status.h"
+#include "keepalive_core.h"
+#include "keepalive_task.h"
+#include "keepalive_util.h"
 
 // ===== 日志模式 =====
 enum LogMode {
@@ -35,112 +52,540 @@ static std::wstring g_log_filename;
 
 // ===== 全局状态 =====
 std::vector<std::wstring> g_blocked;
+std::vector<DutyCycleDevice> g_duty_devices;
 WCHAR g_last_device[256] = L"";
-bool g_need_restart = false;
-bool g_is_playing = false;
+WCHAR g_last_device_id[128] = L"";
+std::mutex g_device_mutex;       // 保护 g_last_device/g_last_device_id，回调线程写、主循环和状态查询读
+HANDLE g_restart_event = NULL;   // 有设备通知时唤醒主循环
+HANDLE g_quit_event = NULL;
+HANDLE g_main_done_event = NULL;
+std::atomic<bool> g_is_playing(false);   // 只由音频线程写，其他线程只读
+std::atomic<bool> g_bursting(false);     // 间歇保活中：每个 burst 都开关一次流，不逐次写日志
+std::atomic<bool> g_other_audio_paused(false);   // --pause-on-audio：别的程序在放声音，保活暂停中
+// 每个音频线程自己的枚举器，以及该线程是否已被看门狗放弃（放弃后晚到的结果不再改全局状态）
+static thread_local IMMDeviceEnumerator* t_audio_enum = nullptr;
+static thread_local const std::atomic<bool>* t_audio_abandoned = nullptr;
+static bool audio_abandoned() {
+    return t_audio_abandoned && t_audio_abandoned->load();
+}
 bool g_playback_failed_logged = false;
+std::atomic<uint64_t> g_wakeups(0);   // 本进程各线程从等待中醒来的次数，供资源监控统计
 
 // ===== 时间戳 =====
-std::wstring current_time() {
+// 写入 buf（至少 LOG_TIMESTAMP_LEN + 1 个字符），返回长度
+size_t current_time(wchar_t* buf) {
     SYSTEMTIME st;
     GetLocalTime(&st);
-    wchar_t buf[64];
-    swprintf_s(buf, 64, L"[%04d/%02d/%02d - %02d:%02d:%02d] ",
-        st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
-    return buf;
+    LogTimestamp t = { st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond };
+    return format_log_timestamp(buf, t);
+}
+
+// 以当前时间戳开头的一行日志
+static LogText timestamped() {
+    wchar_t buf[LOG_TIMESTAMP_LEN + 1];
+    LogText line;
+    line.append(buf, current_time(buf));
+    return line;
+}
+
+// ===== 单调时钟 =====
+static LARGE_INTEGER g_qpc_freq;
+static LARGE_INTEGER g_qpc_base;
+
+void init_clock() {
+    QueryPerformanceFrequency(&g_qpc_freq);
+    QueryPerformanceCounter(&g_qpc_base);
+}
+
+// 进程启动以来的微秒数
+LONGLONG now_us() {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (now.QuadPart - g_qpc_base.QuadPart) * 1000000 / g_qpc_freq.QuadPart;
 }
 
 // ===== 日志写入 =====
-void write_log(const std::wstring& msg) {
+// 调用方只负责加时间戳并入队，控制台/文件写入都在后台日志线程中批量完成。
+// 行文本拼在定长 LogText 里，入队时追加到预留容量的字符缓冲区；日志线程与写入方交换缓冲区，
+// 容量来回复用，稳态下写日志不做堆分配。
+enum LogLevel {
+    LV_INFO = 0,
+    LV_WARN = 1,
+    LV_ERROR = 2
+};
+
+// 限速分类：设备通知与播放状态在蓝牙反复断连时会刷屏
+enum LogCategory {
+    LC_GENERAL = 0,
+    LC_DEVICE = 1,
+    LC_PLAYBACK = 2,
+    LC_COUNT
+};
+
+struct LogLine {
+    size_t offset;   // 在本批字符缓冲区中的位置
+    size_t len;
+    LogLevel level;
+};
+
+static const size_t LOG_QUEUE_MAX = 4096;   // 队列上限，防止事件风暴时无限增长
+static const DWORD LOG_FLUSH_MS = 50;       // 普通日志最多延迟这么久再落盘/上屏
+static const size_t LOG_RESERVE_LINES = 256;   // 预留容量，事件风暴时才会增长
+static const ULONGLONG LOG_WINDOW_MS = 60000;  // 重复/限速统计窗口
+
+static std::mutex g_log_mutex;
+static std::condition_variable g_log_cv;
+static std::vector<LogLine> g_log_queue;
+static std::wstring g_log_text;            // g_log_queue 各行的文本
+static bool g_log_urgent = false;
+static bool g_log_stop = false;
+static size_t g_log_dropped = 0;
+static std::thread g_log_thread;
+static HANDLE g_console = INVALID_HANDLE_VALUE;
+
+// ===== 重复抑制与限速 =====
+// 令牌桶：capacity 为 0 表示不限速
+struct TokenBucket {
+    double capacity;
+    double refill_per_ms;
+    double tokens;
+    ULONGLONG last_ms;
+};
+
+static const wchar_t* LOG_CATEGORY_NAMES[LC_COUNT] = { L"general", L"device", L"playback" };
+static TokenBucket g_log_buckets[LC_COUNT] = {
+    { 0, 0, 0, 0 },
+    { 20, 20.0 / LOG_WINDOW_MS, 20, 0 },
+    { 20, 20.0 / LOG_WINDOW_MS, 20, 0 },
+};
+static LogText g_log_last_msg;
+static size_t g_log_repeats = 0;
+static size_t g_log_suppressed[LC_COUNT] = {};
+static ULONGLONG g_log_window_start = 0;
+
+static bool take_token(TokenBucket& b, ULONGLONG now) {
+    if (b.capacity <= 0) return true;
+    b.tokens += (double)(now - b.last_ms) * b.refill_per_ms;
+    if (b.tokens > b.capacity) b.tokens = b.capacity;
+    b.last_ms = now;
+    if (b.tokens < 1.0) return false;
+    b.tokens -= 1.0;
+    return true;
+}
+
+static bool log_window_pending_locked() {
+    if (g_log_repeats > 0) return true;
+    for (int c = 0; c < LC_COUNT; c++)
+        if (g_log_suppressed[c] > 0) return true;
+    return false;
+}
+
+// 队列满了丢弃并计数，返回 false
+static bool push_log_locked(const LogText& text, LogLevel level) {
+    if (g_log_queue.size() >= LOG_QUEUE_MAX) {
+        g_log_dropped++;
+        return false;
+    }
+    g_log_queue.push_back({ g_log_text.size(), text.size(), level });
+    g_log_text.append(text.c_str(), text.size());
+    if (level == LV_ERROR) g_log_urgent = true;
+    return true;
+}
+
+static void flush_log_repeats_locked() {
+    if (g_log_repeats == 0) return;
+    push_log_locked(timestamped() << L"Last message repeated " << (uint64_t)g_log_repeats << L" times.", LV_INFO);
+    g_log_repeats = 0;
+}
+
+// 窗口结束：报告折叠的重复次数和各分类被限速丢弃的条数
+static void report_log_window_locked(ULONGLONG now) {
+    flush_log_repeats_locked();
+    for (int c = 0; c < LC_COUNT; c++) {
+        if (g_log_suppressed[c] == 0) continue;
+        push_log_locked(timestamped() << L"Rate limit: suppressed " << (uint64_t)g_log_suppressed[c] << L" " <<
+                        LOG_CATEGORY_NAMES[c] << L" messages in the last " <<
+                        (uint64_t)((now - g_log_window_start) / 1000) << L" s.", LV_INFO);
+        g_log_suppressed[c] = 0;
+    }
+    g_log_window_start = now;
+}
+
+void write_log(const wchar_t* msg, LogLevel level = LV_INFO, LogCategory cat = LC_GENERAL) {
     if (g_mode == LOG_NONE) return;
-    std::wstring line = current_time() + msg;
+    ULONGLONG now = GetTickCount64();
 
-    if (g_mode & LOG_CONSOLE) {
-        int len = WideCharToMultiByte(CP_UTF8, 0, line.c_str(), -1, nullptr, 0, nullptr, nullptr);
-        if (len > 0) {
-            std::string buf(len, 0);
-            WideCharToMultiByte(CP_UTF8, 0, line.c_str(), -1, &buf[0], len, nullptr, nullptr);
-            printf("%s\n", buf.c_str());
-            fflush(stdout);
+    {
+        std::lock_guard<std::mutex> lk(g_log_mutex);
+        if (now - g_log_window_start >= LOG_WINDOW_MS) report_log_window_locked(now);
+
+        if (g_log_last_msg == msg) {
+            g_log_repeats++;
+            return;
+        }
+        flush_log_repeats_locked();
+        // 只有真正写进日志的消息才能被后面的重复折叠，否则 "Last message repeated" 指的是日志里没有的一行。
+        // 错误不限速
+        g_log_last_msg.clear();
+        if (level != LV_ERROR && !take_token(g_log_buckets[cat], now)) {
+            g_log_suppressed[cat]++;
+            return;
+        }
+        if (push_log_locked(timestamped() << msg, level)) g_log_last_msg.append(msg);
+    }
+    g_log_cv.notify_one();
+}
+
+void write_log(const LogText& msg, LogLevel level = LV_INFO, LogCategory cat = LC_GENERAL) {
+    write_log(msg.c_str(), level, cat);
+}
+
+// 启动、退出等冷路径上的拼接消息
+void write_log(const std::wstring& msg, LogLevel level = LV_INFO, LogCategory cat = LC_GENERAL) {
+    write_log(msg.c_str(), level, cat);
+}
+
+// 一批日志：控制台一次 WriteConsoleW（UTF-16 直写），文件一次 WriteFile
+static void flush_log_batch(const std::vector<LogLine>& batch, const std::wstring& text,
+                            std::wstring& con_buf, std::string& file_buf) {
+    if ((g_mode & LOG_CONSOLE) && g_console != INVALID_HANDLE_VALUE) {
+        con_buf.clear();
+        for (const auto& l : batch) {
+            con_buf.append(text, l.offset, l.len);
+            con_buf += L"\r\n";
         }
+        DWORD written = 0;
+        WriteConsoleW(g_console, con_buf.c_str(), (DWORD)con_buf.size(), &written, NULL);
     }
 
     if ((g_mode & LOG_VERBOSE) && !g_log_filename.empty()) {
+        file_buf.clear();
+        for (const auto& l : batch) {
+            append_utf8(file_buf, text.data() + l.offset, l.len);
+            file_buf += "\r\n";
+        }
         HANDLE hFile = CreateFileW(g_log_filename.c_str(),
                                    FILE_APPEND_DATA, FILE_SHARE_READ,
                                    NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
         if (hFile != INVALID_HANDLE_VALUE) {
             DWORD written = 0;
-            int len = WideCharToMultiByte(CP_UTF8, 0, line.c_str(), -1, NULL, 0, NULL, NULL);
-            if (len > 0) {
-                std::string utf8line(len - 1, 0);
-                WideCharToMultiByte(CP_UTF8, 0, line.c_str(), -1, &utf8line[0], len, NULL, NULL);
-                WriteFile(hFile, utf8line.c_str(), (DWORD)utf8line.size(), &written, NULL);
-                WriteFile(hFile, "\r\n", 2, &written, NULL);
-            }
+            WriteFile(hFile, file_buf.c_str(), (DWORD)file_buf.size(), &written, NULL);
             CloseHandle(hFile);
         }
     }
 }
 
-// ===== UTF-8 → Wide =====
-std::wstring utf8_to_wstring(const std::string& s) {
-    if (s.empty()) return {};
-    int n = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), (int)s.size(), NULL, 0);
-    std::wstring out(n, 0);
-    MultiByteToWideChar(CP_UTF8, 0, s.c_str(), (int)s.size(), &out[0], n);
-    return out;
+static void log_thread_proc() {
+    std::vector<LogLine> batch;
+    std::wstring batch_text;
+    std::wstring con_buf;
+    std::string file_buf;
+    batch.reserve(LOG_RESERVE_LINES);
+    batch_text.reserve(LOG_RESERVE_LINES * 64);
+
+    std::unique_lock<std::mutex> lk(g_log_mutex);
+    auto has_work = [] { return g_log_stop || !g_log_queue.empty(); };
+    while (true) {
+        // 只有存在待报告的重复/限速计数时才定时醒来，空闲时不产生唤醒
+        if (log_window_pending_locked()) {
+            ULONGLONG due = g_log_window_start + LOG_WINDOW_MS;
+            ULONGLONG now = GetTickCount64();
+            if (now < due) g_log_cv.wait_for(lk, std::chrono::milliseconds(due - now), has_work);
+            g_wakeups.fetch_add(1, std::memory_order_relaxed);
+            now = GetTickCount64();
+            if (now >= due || g_log_stop) report_log_window_locked(now);
+        } else {
+            g_log_cv.wait(lk, has_work);
+            g_wakeups.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (!has_work()) continue;
+
+        // 攒一小段时间再写；错误日志或退出时立即写
+        if (!g_log_stop && !g_log_urgent)
+            g_log_cv.wait_for(lk, std::chrono::milliseconds(LOG_FLUSH_MS),
+                              [] { return g_log_stop || g_log_urgent; });
+        if (g_log_stop) report_log_window_locked(GetTickCount64());
+
+        batch.swap(g_log_queue);
+        batch_text.swap(g_log_text);
+        size_t dropped = g_log_dropped;
+        g_log_dropped = 0;
+        g_log_urgent = false;
+        bool stop = g_log_stop;
+        lk.unlock();
+
+        if (dropped > 0) {
+            LogText line = timestamped() << L"Log queue full, dropped " << (uint64_t)dropped << L" lines.";
+            batch.push_back({ batch_text.size(), line.size(), LV_ERROR });
+            batch_text.append(line.c_str(), line.size());
+        }
+        if (!batch.empty()) flush_log_batch(batch, batch_text, con_buf, file_buf);
+        batch.clear();
+        batch_text.clear();
+
+        lk.lock();
+        if (stop && g_log_queue.empty()) break;
+    }
+}
+
+void start_logger() {
+    if (g_mode == LOG_NONE) return;
+    if (g_mode & LOG_CONSOLE)
+        g_console = CreateFileW(L"CONOUT$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_WRITE,
+                                NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    g_log_window_start = GetTickCount64();
+    for (auto& b : g_log_buckets) b.last_ms = g_log_window_start;
+    g_log_queue.reserve(LOG_RESERVE_LINES);
+    g_log_text.reserve(LOG_RESERVE_LINES * 64);
+    g_log_thread = std::thread(log_thread_proc);
 }
 
-// ===== 读取阻止设备列表 =====
-std::vector<std::wstring> read_blocked_devices(const char* filename) {
-    std::vector<std::wstring> list;
-    std::ifstream fin(filename, std::ios::binary);
-    if (!fin.is_open()) return list;
+void stop_logger() {
+    if (!g_log_thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lk(g_log_mutex);
+        g_log_stop = true;
+    }
+    g_log_cv.notify_one();
+    g_log_thread.join();
+    if (g_console != INVALID_HANDLE_VALUE) CloseHandle(g_console);
+    g_console = INVALID_HANDLE_VALUE;
+}
+
+// ===== Trace 事件（Chrome/Perfetto trace-event JSON）=====
+// 事件先进有界缓冲，由 trace 线程每秒序列化并追加到文件。
+// 使用 JSON Array 格式，进程被直接结束时文件也能被 trace viewer 打开。
+struct TraceEvent {
+    const char* name;
+    const char* cat;
+    char phase;
+    DWORD tid;
+    LONGLONG ts_us;
+    LONGLONG dur_us;
+};
 
-    std::ostringstream ss;
-    ss << fin.rdbuf();
-    std::string all = ss.str();
-    fin.close();
+static const size_t TRACE_EVENTS_MAX = 8192;
+static const size_t TRACE_BUF_SIZE = 64 * 1024;
+static const DWORD TRACE_FLUSH_MS = 1000;
 
-    if (all.size() >= 3 && (unsigned char)all[0] == 0xEF &&
-        (unsigned char)all[1] == 0xBB && (unsigned char)all[2] == 0xBF)
-        all = all.substr(3);
+static bool g_trace_enabled = false;
+static HANDLE g_trace_file = INVALID_HANDLE_VALUE;
+static std::mutex g_trace_mutex;
+static std::condition_variable g_trace_cv;
+static std::vector<TraceEvent> g_trace_events;
+static size_t g_trace_dropped = 0;
+static bool g_trace_stop = false;
+static std::thread g_trace_thread;
 
-    std::istringstream lines(all);
-    std::string line;
-    while (std::getline(lines, line)) {
-        if (!line.empty() && line.back() == '\r') line.pop_back();
-        size_t s = line.find_first_not_of(" \t");
-        size_t e = line.find_last_not_of(" \t");
-        if (s != std::string::npos)
-            list.push_back(utf8_to_wstring(line.substr(s, e - s + 1)));
+void trace_event(const char* name, const char* cat, char phase, LONGLONG ts_us, LONGLONG dur_us) {
+    if (!g_trace_enabled) return;
+    DWORD tid = GetCurrentThreadId();
+    std::lock_guard<std::mutex> lk(g_trace_mutex);
+    if (g_trace_events.size() >= TRACE_EVENTS_MAX) {
+        g_trace_dropped++;
+        return;
     }
-    return list;
+    g_trace_events.push_back({ name, cat, phase, tid, ts_us, dur_us });
 }
 
-// ===== 判断设备是否被阻止 =====
-bool is_blocked_device(const WCHAR* name, const std::vector<std::wstring>& blocked) {
-    for (const auto& b : blocked) {
-        if (wcsstr(name, b.c_str())) return true;
+void trace_instant(const char* name, const char* cat) {
+    if (g_trace_enabled) trace_event(name, cat, 'i', now_us(), 0);
+}
+
+// 作用域内的耗时区间，未开启 trace 时只有一次判断
+struct TraceSpan {
+    const char* name;
+    const char* cat;
+    LONGLONG start;
+    TraceSpan(const char* n, const char* c) : name(n), cat(c), start(g_trace_enabled ? now_us() : 0) {}
+    ~TraceSpan() {
+        if (g_trace_enabled) trace_event(name, cat, 'X', start, now_us() - start);
+    }
+};
+
+// 固定大小缓冲区，写满才落盘
+struct TraceWriter {
+    HANDLE file;
+    char buf[TRACE_BUF_SIZE];
+    size_t len = 0;
+
+    void flush() {
+        DWORD written = 0;
+        if (len > 0) WriteFile(file, buf, (DWORD)len, &written, NULL);
+        len = 0;
+    }
+    void append(const char* s, size_t n) {
+        if (len + n > sizeof(buf)) flush();
+        memcpy(buf + len, s, n);
+        len += n;
+    }
+};
+
+static void write_trace_event(TraceWriter& w, const TraceEvent& e) {
+    char line[256];
+    int n;
+    if (e.phase == 'X')
+        n = sprintf_s(line, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%lu,\"tid\":%lu},\n",
+                      e.name, e.cat, e.ts_us, e.dur_us, GetCurrentProcessId(), e.tid);
+    else
+        n = sprintf_s(line, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"s\":\"t\",\"ts\":%lld,\"pid\":%lu,\"tid\":%lu},\n",
+                      e.name, e.cat, e.phase, e.ts_us, GetCurrentProcessId(), e.tid);
+    if (n > 0) w.append(line, (size_t)n);
+}
+
+static void trace_thread_proc() {
+    static TraceWriter w;
+    w.file = g_trace_file;
+    w.append("[\n", 2);
+
+    std::vector<TraceEvent> batch;
+    batch.reserve(TRACE_EVENTS_MAX);
+    std::unique_lock<std::mutex> lk(g_trace_mutex);
+    while (true) {
+        g_trace_cv.wait_for(lk, std::chrono::milliseconds(TRACE_FLUSH_MS), [] { return g_trace_stop; });
+        g_wakeups.fetch_add(1, std::memory_order_relaxed);
+        batch.swap(g_trace_events);
+        size_t dropped = g_trace_dropped;
+        g_trace_dropped = 0;
+        bool stop = g_trace_stop;
+        lk.unlock();
+
+        for (const auto& e : batch) write_trace_event(w, e);
+        if (dropped > 0) {
+            char line[160];
+            int n = sprintf_s(line, "{\"name\":\"trace_dropped\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%lld,\"pid\":%lu,\"tid\":0,\"args\":{\"count\":%zu}},\n",
+                              now_us(), GetCurrentProcessId(), dropped);
+            if (n > 0) w.append(line, (size_t)n);
+        }
+        batch.clear();
+        w.flush();
+
+        lk.lock();
+        if (stop) break;
+    }
+}
+
+bool start_trace(const std::wstring& path) {
+    g_trace_file = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+                               NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (g_trace_file == INVALID_HANDLE_VALUE) return false;
+    g_trace_events.reserve(TRACE_EVENTS_MAX);
+    g_trace_enabled = true;
+    g_trace_thread = std::thread(trace_thread_proc);
+    return true;
+}
+
+void stop_trace() {
+    if (!g_trace_thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lk(g_trace_mutex);
+        g_trace_stop = true;
+    }
+    g_trace_cv.notify_one();
+    g_trace_thread.join();
+    g_trace_enabled = false;
+    CloseHandle(g_trace_file);
+    g_trace_file = INVALID_HANDLE_VALUE;
+}
+
+// ===== 运行计数 =====
+struct Counters {
+    std::atomic<uint64_t> notifications{ 0 };
+    std::atomic<uint64_t> restarts{ 0 };
+    std::atomic<uint64_t> suppressed_restarts{ 0 };   // 新设备在阻止列表中，没有启动播放
+    std::atomic<uint64_t> playback_failures{ 0 };
+    std::atomic<uint64_t> start_retries{ 0 };         // 启动失败后按退避间隔重试的次数
+    std::atomic<uint64_t> stream_underruns{ 0 };      // 健康探测时流没有前进
+    std::atomic<uint64_t> stream_stalls{ 0 };         // 连续多次没前进，判定卡死并重启
+    std::atomic<uint64_t> duty_bursts{ 0 };           // 间歇保活播放的 burst 数
+    std::atomic<uint64_t> duty_misses{ 0 };           // 距上个 burst 已超过设备空闲超时才开流
+    std::atomic<uint64_t> other_audio_pauses{ 0 };    // 因为别的程序在放声音而暂停保活
+    std::atomic<uint64_t> handovers{ 0 };             // 先建后拆换到另一个 endpoint
+    // 按回调类型统计的原始通知数
+    std::atomic<uint64_t> notify_default_changed{ 0 };
+    std::atomic<uint64_t> notify_added{ 0 };
+    std::atomic<uint64_t> notify_removed{ 0 };
+    std::atomic<uint64_t> notify_state_changed{ 0 };
+    std::atomic<uint64_t> notify_property_changed{ 0 };
+};
+static Counters g_counters;
+static std::atomic<uint32_t> g_start_streak(0);   // 当前默认设备连续启动失败的次数
+// 流打开的时间占比。只由主循环线程更新（now_us() / 1000 毫秒），其他线程读下面的快照
+static DutyCycleMeter g_stream_meter;
+static std::atomic<uint32_t> g_duty_permille(0);
+static std::atomic<uint64_t> g_stream_active_ms(0);
+static ULONGLONG g_start_tick = 0;
+
+// ===== 重连延迟统计 =====
+// 从收到设备通知到静音播放恢复，分段记录：
+// dispatch = 通知到主循环接手；resolve = 主循环经音频线程解析默认设备名；
+// start    = 主循环接手到播放成功；total = 端到端
+enum LatencyStage {
+    LS_RESOLVE = 0,
+    LS_DISPATCH = 1,
+    LS_START = 2,
+    LS_TOTAL = 3,
+    LS_COUNT
+};
+
+static const wchar_t* LATENCY_STAGE_NAMES[LS_COUNT] = { L"resolve", L"dispatch", L"start", L"total" };
+static const LONGLONG LATENCY_SLO_US = 100000;         // 目标：100 ms 内恢复播放
+static const DWORD LATENCY_REPORT_MS = 10 * 60 * 1000;
+
+static LatencyHistogram g_latency[LS_COUNT];
+static std::atomic<LONGLONG> g_notify_us(0);   // 本轮第一条通知的时间，0 表示没有待处理的通知
+static uint64_t g_latency_reported = 0;
+
+// 一连串通知只记第一条的时间
+void mark_notification(LONGLONG t) {
+    g_counters.notifications.fetch_add(1, std::memory_order_relaxed);
+    LONGLONG expected = 0;
+    g_notify_us.compare_exchange_strong(expected, t > 0 ? t : 1);
+}
+
+void report_latency(bool at_exit) {
+    static LatencyHistogram::Snapshot snap;
+    g_latency[LS_TOTAL].snapshot(snap);
+    if (snap.total == g_latency_reported && !(at_exit && snap.total > 0)) return;
+    g_latency_reported = snap.total;
+
+    for (int i = 0; i < LS_COUNT; i++) {
+        g_latency[i].snapshot(snap);
+        if (snap.total == 0) continue;
+        wchar_t buf[256];
+        swprintf_s(buf, L"Latency %s: n=%llu p50=%.1fms p90=%.1fms p99=%.1fms max=%.1fms",
+                   LATENCY_STAGE_NAMES[i], (unsigned long long)snap.total,
+                   snap.percentile(50) / 1000.0, snap.percentile(90) / 1000.0,
+                   snap.percentile(99) / 1000.0, snap.max() / 1000.0);
+        LogText line(buf);
+        if (i == LS_TOTAL) {
+            swprintf_s(buf, L" within %lldms: %llu/%llu", LATENCY_SLO_US / 1000,
+                       (unsigned long long)snap.count_at_or_below(LATENCY_SLO_US), (unsigned long long)snap.total);
+            line << buf;
+        }
+        write_log(line);
     }
-    return false;
 }
 
 // ===== 获取默认播放设备名称 =====
-bool get_default_audio_device_name(WCHAR* name, int max_len) {
+// 只在音频线程调用，使用该线程持有的枚举器
+bool get_default_audio_device_name(WCHAR* name, int max_len, WCHAR* id = nullptr, int id_len = 0) {
+    TraceSpan span("get_default_audio_device_name", "device");
     HRESULT hr;
     bool result = false;
-    CoInitialize(NULL);
-
-    IMMDeviceEnumerator* pEnum = nullptr;
-    hr = CoCreateInstance(CLSID_MMDeviceEnumerator, NULL, CLSCTX_ALL,
-                          IID_PPV_ARGS(&pEnum));
-    if (FAILED(hr)) goto cleanup;
+    if (!t_audio_enum) return false;
 
     IMMDevice* pDevice = nullptr;
-    hr = pEnum->GetDefaultAudioEndpoint(eRender, eConsole, &pDevice);
-    if (FAILED(hr)) goto cleanup_enum;
+    hr = t_audio_enum->GetDefaultAudioEndpoint(eRender, eConsole, &pDevice);
+    if (FAILED(hr)) return false;
+
+    if (id) {
+        LPWSTR pwszId = nullptr;
+        if (SUCCEEDED(pDevice->GetId(&pwszId))) {
+            wcsncpy_s(id, id_len, pwszId, _TRUNCATE);
+            CoTaskMemFree(pwszId);
+        }
+    }
 
     IPropertyStore* pProps = nullptr;
     hr = pDevice->OpenPropertyStore(STGM_READ, &pProps);
@@ -157,16 +602,314 @@ bool get_default_audio_device_name(WCHAR* name, int max_len) {
     pProps->Release();
 cleanup_device:
     pDevice->Release();
-cleanup_enum:
-    pEnum->Release();
-cleanup:
-    CoUninitialize();
     return result;
 }
 
+void copy_current_device(WCHAR* out, size_t len, WCHAR* id = nullptr, size_t id_len = 0) {
+    std::lock_guard<std::mutex> lk(g_device_mutex);
+    wcsncpy_s(out, len, g_last_device, _TRUNCATE);
+    if (id) wcsncpy_s(id, id_len, g_last_device_id, _TRUNCATE);
+}
+
+// ===== 共享内存状态页 =====
+// 布局见 keepalive_status.h。只由主循环写，外部读者用 seqlock 取快照，不进入本进程。
+static KeepaliveStatusMapping g_status_map = {};
+static KeepaliveStatusData g_status_data = {};
+
+static uint64_t unix_ms_now() {
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    ULONGLONG t = ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return (t - 116444736000000000ULL) / 10000;
+}
+
+static void copy_utf16(uint16_t* dst, size_t n, const WCHAR* src) {
+    size_t i = 0;
+    for (; i + 1 < n && src[i]; i++) dst[i] = (uint16_t)src[i];
+    dst[i] = 0;
+}
+
+void publish_status() {
+    KeepaliveStatusData d = g_status_data;
+    WCHAR name[128], id[128];
+    copy_current_device(name, 128, id, 128);
+    copy_utf16(d.device_name, 128, name);
+    copy_utf16(d.endpoint_id, 128, id);
+    d.playing = g_is_playing ? 1 : 0;
+    d.blocked = is_blocked_device(name, g_blocked) ? 1 : 0;
+    d.notifications = g_counters.notifications.load(std::memory_order_relaxed);
+    d.restarts = g_counters.restarts.load(std::memory_order_relaxed);
+    d.playback_failures = g_counters.playback_failures.load(std::memory_order_relaxed);
+    if (d.playing != g_status_data.playing || d.blocked != g_status_data.blocked ||
+        memcmp(d.endpoint_id, g_status_data.endpoint_id, sizeof(d.endpoint_id)) != 0)
+        d.last_change_unix_ms = unix_ms_now();
+    g_status_data = d;
+    if (g_status_map.page) keepalive_status_publish(g_status_map.page, d);
+}
+
+// ===== 设备可用性账本 =====
+// 按 endpoint ID 累计：作为默认设备的时间、其中保活播放/被阻止的时间、断开次数、重连延迟。
+// 内存中累加，每 5 分钟和退出时把有变化的设备各追加一条定长记录（一次 WriteFile，不 fsync），
+// 文件超过一定大小后按设备合并重写。
+#define LEDGER_MAGIC 0x524C414Bu   // "KALR"
+
+struct LedgerRecord {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t written_unix_ms;
+    char endpoint_id[64];           // UTF-8
+    char device_name[80];           // UTF-8，截断
+    uint32_t connected_s;           // 以下均为本条记录覆盖的增量
+    uint32_t kept_alive_s;
+    uint32_t blocked_s;
+    uint32_t disconnects;
+    uint32_t reconnects;
+    uint32_t reserved2;
+    uint64_t reconnect_latency_us;
+};
+static_assert(sizeof(LedgerRecord) == 192, "ledger record layout changed");
+
+enum LedgerState {
+    LG_NONE = 0,
+    LG_CONNECTED = 1,      // 是默认设备但没在播放（如播放失败）
+    LG_KEPT_ALIVE = 2,
+    LG_BLOCKED = 3
+};
+
+struct LedgerAcc {
+    std::wstring name;
+    uint64_t connected_ms, kept_alive_ms, blocked_ms;
+    uint32_t disconnects, reconnects;
+    uint64_t reconnect_latency_us;
+    bool dirty;
+};
+
+static const DWORD LEDGER_FLUSH_MS = 5 * 60 * 1000;
+static const LONGLONG LEDGER_COMPACT_BYTES = 2048 * (LONGLONG)sizeof(LedgerRecord);
+
+static std::mutex g_ledger_mutex;
+static std::map<std::wstring, LedgerAcc, std::less<>> g_ledger;   // 键为 endpoint ID；回调里按 WCHAR* 查找不构造临时串
+static std::wstring g_ledger_path;
+static std::wstring g_ledger_cur;
+static LedgerState g_ledger_state = LG_NONE;
+static ULONGLONG g_ledger_since = 0;
+
+static void copy_utf8_field(char* dst, size_t n, const std::wstring& w) {
+    std::string u;
+    append_utf8(u, w);
+    size_t len = u.size() < n - 1 ? u.size() : n - 1;
+    while (len > 0 && len < u.size() && ((unsigned char)u[len] & 0xC0) == 0x80) len--;   // 不截断多字节字符
+    memcpy(dst, u.data(), len);
+    memset(dst + len, 0, n - len);
+}
+
+static std::wstring exe_dir_path(const wchar_t* file) {
+    wchar_t path[MAX_PATH];
+    DWORD n = GetModuleFileNameW(NULL, path, MAX_PATH);
+    std::wstring dir(path, n);
+    size_t slash = dir.find_last_of(L"\\/");
+    dir = slash == std::wstring::npos ? L"" : dir.substr(0, slash + 1);
+    return dir + file;
+}
+
+static void ledger_accrue_locked(ULONGLONG now) {
+    if (g_ledger_state != LG_NONE && !g_ledger_cur.empty()) {
+        LedgerAcc& a = g_ledger[g_ledger_cur];
+        uint64_t d = now - g_ledger_since;
+        a.connected_ms += d;
+        if (g_ledger_state == LG_KEPT_ALIVE) a.kept_alive_ms += d;
+        if (g_ledger_state == LG_BLOCKED) a.blocked_ms += d;
+        a.dirty = true;
+    }
+    g_ledger_since = now;
+}
+
+void ledger_set_state(const WCHAR* id, const WCHAR* name, LedgerState state) {
+    std::lock_guard<std::mutex> lk(g_ledger_mutex);
+    ledger_accrue_locked(GetTickCount64());
+    g_ledger_cur = id;
+    g_ledger_state = id[0] ? state : LG_NONE;
+    if (id[0]) g_ledger[g_ledger_cur].name = name;
+}
+
+// 回调线程调用：只统计曾经作为默认设备出现过的 endpoint
+void ledger_note_disconnect(const WCHAR* id) {
+    if (!id) return;
+    std::lock_guard<std::mutex> lk(g_ledger_mutex);
+    auto it = g_ledger.find(id);
+    if (it == g_ledger.end()) return;
+    it->second.disconnects++;
+    it->second.dirty = true;
+}
+
+void ledger_note_reconnect(LONGLONG latency_us) {
+    std::lock_guard<std::mutex> lk(g_ledger_mutex);
+    if (g_ledger_cur.empty()) return;
+    LedgerAcc& a = g_ledger[g_ledger_cur];
+    a.reconnects++;
+    a.reconnect_latency_us += (uint64_t)latency_us;
+    a.dirty = true;
+}
+
+static bool read_ledger(const std::wstring& path, std::vector<LedgerRecord>& out) {
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                           NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    GetFileSizeEx(h, &size);
+    out.resize((size_t)(size.QuadPart / sizeof(LedgerRecord)));
+    DWORD n = 0;
+    if (!out.empty()) ReadFile(h, out.data(), (DWORD)(out.size() * sizeof(LedgerRecord)), &n, NULL);
+    CloseHandle(h);
+    out.resize(n / sizeof(LedgerRecord));
+    return true;
+}
+
+static void merge_record(std::map<std::string, LedgerRecord>& merged, const LedgerRecord& r) {
+    if (r.magic != LEDGER_MAGIC) return;
+    auto it = merged.find(r.endpoint_id);
+    if (it == merged.end()) {
+        merged[r.endpoint_id] = r;
+        return;
+    }
+    LedgerRecord& m = it->second;
+    m.written_unix_ms = r.written_unix_ms;
+    memcpy(m.device_name, r.device_name, sizeof(m.device_name));
+    m.connected_s += r.connected_s;
+    m.kept_alive_s += r.kept_alive_s;
+    m.blocked_s += r.blocked_s;
+    m.disconnects += r.disconnects;
+    m.reconnects += r.reconnects;
+    m.reconnect_latency_us += r.reconnect_latency_us;
+}
+
+// 每个设备合并成一条，写临时文件后替换
+static void compact_ledger() {
+    std::vector<LedgerRecord> records;
+    if (!read_ledger(g_ledger_path, records)) return;
+    std::map<std::string, LedgerRecord> merged;
+    for (const auto& r : records) merge_record(merged, r);
+
+    std::vector<LedgerRecord> out;
+    for (const auto& kv : merged) out.push_back(kv.second);
+    std::wstring tmp = g_ledger_path + L".tmp";
+    HANDLE h = CreateFileW(tmp.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) return;
+    DWORD written = 0;
+    BOOL ok = WriteFile(h, out.data(), (DWORD)(out.size() * sizeof(LedgerRecord)), &written, NULL);
+    CloseHandle(h);
+    if (ok) MoveFileExW(tmp.c_str(), g_ledger_path.c_str(), MOVEFILE_REPLACE_EXISTING);
+    else DeleteFileW(tmp.c_str());
+    write_log(L"Ledger compacted: " + std::to_wstring(records.size()) + L" -> " + std::to_wstring(out.size()) + L" records.");
+}
+
+void flush_ledger() {
+    std::vector<LedgerRecord> batch;
+    {
+        std::lock_guard<std::mutex> lk(g_ledger_mutex);
+        ledger_accrue_locked(GetTickCount64());
+        uint64_t now = unix_ms_now();
+        for (auto& kv : g_ledger) {
+            LedgerAcc& a = kv.second;
+            if (!a.dirty) continue;
+            LedgerRecord r = {};
+            r.magic = LEDGER_MAGIC;
+            r.written_unix_ms = now;
+            copy_utf8_field(r.endpoint_id, sizeof(r.endpoint_id), kv.first);
+            copy_utf8_field(r.device_name, sizeof(r.device_name), a.name);
+            // 秒以下的零头留到下一条记录
+            r.connected_s = (uint32_t)(a.connected_ms / 1000);
+            r.kept_alive_s = (uint32_t)(a.kept_alive_ms / 1000);
+            r.blocked_s = (uint32_t)(a.blocked_ms / 1000);
+            a.connected_ms %= 1000;
+            a.kept_alive_ms %= 1000;
+            a.blocked_ms %= 1000;
+            r.disconnects = a.disconnects;
+            r.reconnects = a.reconnects;
+            r.reconnect_latency_us = a.reconnect_latency_us;
+            a.disconnects = a.reconnects = 0;
+            a.reconnect_latency_us = 0;
+            a.dirty = false;
+            batch.push_back(r);
+        }
+    }
+    if (batch.empty()) return;
+
+    HANDLE h = CreateFileW(g_ledger_path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ,
+                           NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) {
+        write_log(L"Cannot open ledger " + g_ledger_path, LV_ERROR);
+        return;
+    }
+    DWORD written = 0;
+    WriteFile(h, batch.data(), (DWORD)(batch.size() * sizeof(LedgerRecord)), &written, NULL);
+    LARGE_INTEGER size;
+    GetFileSizeEx(h, &size);
+    CloseHandle(h);
+    if (size.QuadPart > LEDGER_COMPACT_BYTES) compact_ledger();
+}
+
+void update_ledger_state() {
+    WCHAR name[256], id[128];
+    copy_current_device(name, 256, id, 128);
+    LedgerState state = is_blocked_device(name, g_blocked) ? LG_BLOCKED
+                      : g_is_playing || g_other_audio_paused ? LG_KEPT_ALIVE : LG_CONNECTED;   // 暂停时设备由别的声音保持唤醒
+    ledger_set_state(id, name, state);
+}
+
+// ===== 设备事件队列与记录 =====
+// 回调线程只把事件投进有界队列并唤醒主循环，是否重启由主循环里的 KeepAliveCore 决定。
+// --record-events <file>：主循环取出的每个事件按 keepalive_core.h 的格式追加到文件，
+// 可以用 keepalive_sim 的 replay 模式离线重放。
+static const size_t EVENT_QUEUE_CAPACITY = 256;
+static const size_t RECORD_BUF_FLUSH = 16 * 1024;
+
+static EventQueue g_events(EVENT_QUEUE_CAPACITY);
+static std::vector<DeviceEvent> g_event_batch;
+static KeepAliveCore g_core(&g_blocked);
+static HANDLE g_record_file = INVALID_HANDLE_VALUE;
+static std::string g_record_buf;
+
+void post_device_event(uint32_t type, LPCWSTR id, DWORD state = 0, const WCHAR* name = nullptr) {
+    if (!g_events.push(make_device_event(now_us(), type, id, state, name)))
+        write_log(L"Device event queue full, will resync.", LV_WARN, LC_DEVICE);
+    SetEvent(g_restart_event);
+}
+
+static bool start_event_recorder(const std::wstring& path) {
+    g_record_file = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (g_record_file == INVALID_HANDLE_VALUE) return false;
+    g_record_buf.reserve(RECORD_BUF_FLUSH * 2);
+    append_event_trace_header(g_record_buf);
+    return true;
+}
+
+static void flush_event_recorder() {
+    if (g_record_file == INVALID_HANDLE_VALUE || g_record_buf.empty()) return;
+    DWORD written = 0;
+    WriteFile(g_record_file, g_record_buf.data(), (DWORD)g_record_buf.size(), &written, NULL);
+    g_record_buf.clear();
+}
+
+static void record_event(const DeviceEvent& e) {
+    if (g_record_file == INVALID_HANDLE_VALUE) return;
+    append_event_record(g_record_buf, e);
+    if (g_record_buf.size() >= RECORD_BUF_FLUSH) flush_event_recorder();
+}
+
+static void stop_event_recorder() {
+    if (g_record_file == INVALID_HANDLE_VALUE) return;
+    flush_event_recorder();
+    CloseHandle(g_record_file);
+    g_record_file = INVALID_HANDLE_VALUE;
+}
+
 // ===== 设备通知回调类 =====
+
 class AudioNotificationClient : public IMMNotificationClient {
 public:
+    std::atomic<bool> muted{ false };   // 所属音频线程被看门狗放弃后不再转发通知，避免与替代线程的注册重复
+
     ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
     ULONG STDMETHODCALLTYPE Release() override { return 1; }
     HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObject) override {
@@ -179,57 +922,1304 @@ public:
         return E_NOINTERFACE;
     }
 
-    HRESULT STDMETHODCALLTYPE OnDefaultDeviceChanged(EDataFlow flow, ERole role, LPCWSTR) override {
+    // 设备名由主循环通过音频线程解析，回调里不碰 COM 对象
+    HRESULT STDMETHODCALLTYPE OnDefaultDeviceChanged(EDataFlow flow, ERole role, LPCWSTR id) override {
+        TraceSpan span("OnDefaultDeviceChanged", "notify");
+        if (muted) return S_OK;
+        g_counters.notify_default_changed.fetch_add(1, std::memory_order_relaxed);
         if (flow == eRender && role == eConsole) {
-            WCHAR cur[256];
-            if (get_default_audio_device_name(cur, 256)) {
-                write_log(L"Device changed -> " + std::wstring(cur));
-                wcscpy_s(g_last_device, cur);
-                g_need_restart = true;
-                g_playback_failed_logged = false;
-            }
+            mark_notification(now_us());
+            g_playback_failed_logged = false;
+            post_device_event(EV_DEFAULT_CHANGED, id, DEVICE_STATE_ACTIVE);
         }
         return S_OK;
     }
-    HRESULT STDMETHODCALLTYPE OnDeviceAdded(LPCWSTR) override { return S_OK; }
-    HRESULT STDMETHODCALLTYPE OnDeviceRemoved(LPCWSTR) override {
-        write_log(L"Audio device removed.");
-        g_need_restart = true;
+    HRESULT STDMETHODCALLTYPE OnDeviceAdded(LPCWSTR id) override {
+        if (muted) return S_OK;
+        g_counters.notify_added.fetch_add(1, std::memory_order_relaxed);
+        // 不影响播放，只在记录事件时入队，不唤醒主循环
+        if (g_record_file != INVALID_HANDLE_VALUE) g_events.push(make_device_event(now_us(), EV_ADDED, id));
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE OnDeviceRemoved(LPCWSTR id) override {
+        if (muted) return S_OK;
+        trace_instant("OnDeviceRemoved", "notify");
+        g_counters.notify_removed.fetch_add(1, std::memory_order_relaxed);
+        mark_notification(now_us());
+        ledger_note_disconnect(id);
+        write_log(L"Audio device removed.", LV_INFO, LC_DEVICE);
+        post_device_event(EV_REMOVED, id);
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE OnDeviceStateChanged(LPCWSTR id, DWORD state) override {
+        if (muted) return S_OK;
+        trace_instant("OnDeviceStateChanged", "notify");
+        g_counters.notify_state_changed.fetch_add(1, std::memory_order_relaxed);
+        mark_notification(now_us());
+        if (state != DEVICE_STATE_ACTIVE) ledger_note_disconnect(id);
+        write_log(L"Audio device state changed.", LV_INFO, LC_DEVICE);
+        post_device_event(EV_STATE_CHANGED, id, state);
         return S_OK;
     }
-    HRESULT STDMETHODCALLTYPE OnDeviceStateChanged(LPCWSTR, DWORD) override {
-        write_log(L"Audio device state changed.");
-        g_need_restart = true;
+    HRESULT STDMETHODCALLTYPE OnPropertyValueChanged(LPCWSTR id, const PROPERTYKEY) override {
+        if (muted) return S_OK;
+        g_counters.notify_property_changed.fetch_add(1, std::memory_order_relaxed);
+        if (g_record_file != INVALID_HANDLE_VALUE) g_events.push(make_device_event(now_us(), EV_PROPERTY_CHANGED, id));
         return S_OK;
     }
-    HRESULT STDMETHODCALLTYPE OnPropertyValueChanged(LPCWSTR, const PROPERTYKEY) override { return S_OK; }
 };
 
-// ===== 控制 PlaySound =====
-void start_playback() {
-    if (!g_is_playing) {
-        if (PlaySoundA((LPCSTR)wav_data, NULL, SND_MEMORY | SND_ASYNC | SND_LOOP | SND_NODEFAULT)) {
-            g_is_playing = true;
-            write_log(L"Playback started.");
-        } else {
-            write_log(L"PlaySound failed!");
+// ===== 播放流健康探测 =====
+// 流开始播放后引擎仍可能悄悄丢掉它（如驱动重置）。
+// 播放期间每 10 秒看一次正拿着的那路流（t_streams，不一定在默认设备上：换设备重试期间旧流还在放）
+// 的音频时钟有没有前进，判定逻辑见 StallDetector。探测函数在静音流一节后面。
+static const DWORD HEALTH_PROBE_MS = 10 * 1000;
+static StallDetector g_stall_detector;
+
+// 音频线程调用。默认设备上其他进程处于活动状态的会话数和其中最大的峰值电平；失败返回 false
+bool probe_other_sessions(float& peak, int& sessions) {
+    TraceSpan span("probe_other_sessions", "other_audio");
+    bool ok = false;
+    IMMDevice* pDevice = nullptr;
+    IAudioSessionManager2* pMgr = nullptr;
+    IAudioSessionEnumerator* pSessions = nullptr;
+    int count = 0;
+    DWORD pid = GetCurrentProcessId();
+    peak = 0.0f;
+    sessions = 0;
+
+    if (!t_audio_enum) goto cleanup;
+    if (FAILED(t_audio_enum->GetDefaultAudioEndpoint(eRender, eConsole, &pDevice))) goto cleanup;
+    if (FAILED(pDevice->Activate(__uuidof(IAudioSessionManager2), CLSCTX_ALL, NULL, (void**)&pMgr))) goto cleanup;
+    if (FAILED(pMgr->GetSessionEnumerator(&pSessions))) goto cleanup;
+    if (FAILED(pSessions->GetCount(&count))) goto cleanup;
+
+    ok = true;
+    for (int i = 0; i < count; i++) {
+        IAudioSessionControl* pCtl = nullptr;
+        if (FAILED(pSessions->GetSession(i, &pCtl))) continue;
+        IAudioSessionControl2* pCtl2 = nullptr;
+        if (SUCCEEDED(pCtl->QueryInterface(IID_PPV_ARGS(&pCtl2)))) {
+            DWORD session_pid = 0;
+            AudioSessionState state = AudioSessionStateInactive;
+            // 只给活动会话开电平表：不活动的会话肯定没有声音
+            if (SUCCEEDED(pCtl2->GetProcessId(&session_pid)) && session_pid != pid &&
+                SUCCEEDED(pCtl2->GetState(&state)) && state == AudioSessionStateActive) {
+                sessions++;
+                IAudioMeterInformation* pMeter = nullptr;
+                float p = 0.0f;
+                if (SUCCEEDED(pCtl->QueryInterface(IID_PPV_ARGS(&pMeter)))) {
+                    if (SUCCEEDED(pMeter->GetPeakValue(&p)) && p > peak) peak = p;
+                    pMeter->Release();
+                }
+            }
+            pCtl2->Release();
+        }
+        pCtl->Release();
+    }
+
+cleanup:
+    if (pSessions) pSessions->Release();
+    if (pMgr) pMgr->Release();
+    if (pDevice) pDevice->Release();
+    return ok;
+}
+
+// ===== 静音流 =====
+// 在指定 endpoint 上用共享模式、混音格式初始化一路 WASAPI 渲染流，缓冲区只填静音（AUDCLNT_BUFFERFLAGS_SILENT）。
+// 不像 PlaySound 那样隐式跟随默认设备，换设备时由 StreamHandover 先开新流再关旧流。
+// 音频线程空闲时每 STREAM_REFILL_MS 补一次静音；缓冲区 2 秒，补得晚一点也不会断流。
+// 流属于开它的音频线程，被看门狗放弃的线程返回后自己关掉。
+// 混音格式和缓冲时长按 endpoint ID 记在 g_stream_pool 里，重连时跳过协商。缓存换音频线程也保留，
+// 被放弃的线程卡完回来可能还会写一次，所以加锁；锁里不做 COM 调用。
+static const REFERENCE_TIME STREAM_BUFFER_HNS = 2 * 10000000;
+static const DWORD STREAM_REFILL_MS = 1000;
+
+static StreamConfigPool g_stream_pool;
+static std::mutex g_stream_pool_mutex;
+
+struct StreamPoolStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    int64_t saved_us;
+    size_t entries;
+    size_t bytes;
+};
+
+static StreamPoolStats stream_pool_stats() {
+    std::lock_guard<std::mutex> lk(g_stream_pool_mutex);
+    return StreamPoolStats{ g_stream_pool.hits(), g_stream_pool.misses(), g_stream_pool.evictions(),
+                            g_stream_pool.saved_us(), g_stream_pool.size(), g_stream_pool.bytes() };
+}
+
+struct SilentStream {
+    IAudioClient* client;
+    IAudioRenderClient* render;
+    IAudioClock* clock;
+    UINT32 frames;
+    UINT64 last_position;   // 上次健康探测时的音频时钟位置
+};
+
+static void refill_silence(SilentStream* s) {
+    UINT32 padding = 0;
+    BYTE* data = nullptr;
+    if (FAILED(s->client->GetCurrentPadding(&padding)) || padding >= s->frames) return;
+    UINT32 n = s->frames - padding;
+    if (SUCCEEDED(s->render->GetBuffer(n, &data))) s->render->ReleaseBuffer(n, AUDCLNT_BUFFERFLAGS_SILENT);
+}
+
+struct WasapiBackend {
+    typedef SilentStream* Stream;
+
+    Stream open(const wchar_t* id) {
+        TraceSpan span("open_stream", "playback");
+        SilentStream s = {};
+        SilentStream* out = nullptr;
+        IMMDevice* pDevice = nullptr;
+        WAVEFORMATEX* fmt = nullptr;
+        alignas(8) BYTE cached[StreamConfigPool::FORMAT_MAX];
+        REFERENCE_TIME buffer = STREAM_BUFFER_HNS;
+        REFERENCE_TIME period = 0;
+        LONGLONG negotiate_us = 0;
+        bool hit = false;
+
+        if (!t_audio_enum) goto cleanup;
+        if (FAILED(t_audio_enum->GetDevice(id, &pDevice))) goto cleanup;
+        if (FAILED(pDevice->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL, (void**)&s.client))) goto cleanup;
+        {
+            std::lock_guard<std::mutex> lk(g_stream_pool_mutex);
+            const StreamConfigPool::Entry* e = g_stream_pool.get(id);
+            if (e) {
+                memcpy(cached, e->format.data(), e->format.size());
+                buffer = e->buffer_hns;
+                hit = true;
+            }
         }
+        if (!hit) {
+            // 缓冲时长取设备默认周期的整数倍
+            LONGLONG t0 = ::now_us();
+            if (FAILED(s.client->GetMixFormat(&fmt))) goto cleanup;
+            if (SUCCEEDED(s.client->GetDevicePeriod(&period, NULL)) && period > 0)
+                buffer = (STREAM_BUFFER_HNS + period - 1) / period * period;
+            negotiate_us = ::now_us() - t0;
+        }
+        if (FAILED(s.client->Initialize(AUDCLNT_SHAREMODE_SHARED, AUDCLNT_STREAMFLAGS_NOPERSIST, buffer, 0,
+                                        hit ? (const WAVEFORMATEX*)cached : fmt, NULL))) {
+            if (hit) {
+                // 格式变了：丢掉缓存，这次失败交给重试，下次重新协商
+                std::lock_guard<std::mutex> lk(g_stream_pool_mutex);
+                g_stream_pool.reject_hit(id);
+            }
+            goto cleanup;
+        }
+        {
+            std::lock_guard<std::mutex> lk(g_stream_pool_mutex);
+            if (hit) g_stream_pool.confirm_hit(id);
+            else g_stream_pool.put(id, fmt, sizeof(WAVEFORMATEX) + fmt->cbSize, buffer, negotiate_us);
+        }
+        if (FAILED(s.client->GetBufferSize(&s.frames))) goto cleanup;
+        if (FAILED(s.client->GetService(__uuidof(IAudioRenderClient), (void**)&s.render))) goto cleanup;
+        if (FAILED(s.client->GetService(__uuidof(IAudioClock), (void**)&s.clock))) goto cleanup;
+        refill_silence(&s);
+        if (FAILED(s.client->Start())) goto cleanup;
+        out = new SilentStream(s);
+
+    cleanup:
+        if (!out) {
+            if (s.clock) s.clock->Release();
+            if (s.render) s.render->Release();
+            if (s.client) s.client->Release();
+        }
+        if (fmt) CoTaskMemFree(fmt);
+        if (pDevice) pDevice->Release();
+        return out;
+    }
+
+    void close(Stream s) {
+        TraceSpan span("close_stream", "playback");
+        s->client->Stop();
+        s->clock->Release();
+        s->render->Release();
+        s->client->Release();
+        delete s;
+    }
+
+    int64_t now_us() { return ::now_us(); }
+};
+
+static thread_local StreamHandover<WasapiBackend> t_streams;
+static LatencyHistogram g_handover_us[2];   // [0] 新设备一侧：开流到出声；[1] 旧设备一侧：新流出声后旧流又放的时长
+
+// 音频线程调用。返回 1 音频时钟比上次探测前进了，0 没前进，-1 没有流或探测失败
+int probe_stream_progress() {
+    TraceSpan span("probe_stream_progress", "health");
+    SilentStream* s = t_streams.stream();
+    UINT64 position = 0;
+    if (!s || FAILED(s->clock->GetPosition(&position, NULL))) return -1;
+    int result = position != s->last_position ? 1 : 0;
+    s->last_position = position;
+    return result;
+}
+
+// 音频线程调用。返回 false 表示没在播放或探测失败，不下结论
+bool observe_stream_health(StallDetector::Verdict& verdict, bool& underrun) {
+    if (!g_is_playing) return false;
+    int progressed = probe_stream_progress();
+    if (progressed < 0 || audio_abandoned()) return false;
+    uint64_t underruns = g_stall_detector.underruns();
+    verdict = g_stall_detector.observe((int64_t)GetTickCount64(), progressed == 1);
+    underrun = g_stall_detector.underruns() != underruns;
+    return true;
+}
+
+// 只在音频线程调用。返回 id 上的新流是否开始播放；失败时原来的流（可能在别的设备上）不动
+bool start_playback(const WCHAR* id) {
+    TraceSpan span("start_playback", "playback");
+    uint64_t handovers = t_streams.handovers();
+    bool ok = t_streams.play(id);
+    if (audio_abandoned()) return false;
+    if (!ok) {
+        g_counters.playback_failures.fetch_add(1, std::memory_order_relaxed);
+        write_log(L"Cannot open the silent stream!", LV_ERROR, LC_PLAYBACK);
+        return false;
+    }
+    g_is_playing = true;
+    g_stall_detector.reset((int64_t)GetTickCount64());
+    if (t_streams.handovers() != handovers) {
+        g_handover_us[0].record(t_streams.last_setup_us());
+        g_handover_us[1].record(t_streams.last_overlap_us());
+        g_counters.handovers.fetch_add(1, std::memory_order_relaxed);
+        write_log(LogText(L"Playback handed over: new stream up in ") << (uint64_t)(t_streams.last_setup_us() / 1000) <<
+                  L" ms, old one released " << (uint64_t)(t_streams.last_overlap_us() / 1000) << L" ms later.", LV_INFO, LC_PLAYBACK);
+    } else if (!g_bursting) {
+        write_log(L"Playback started.", LV_INFO, LC_PLAYBACK);
     }
+    return true;
 }
 
 void stop_playback() {
-    if (g_is_playing) {
-        PlaySound(NULL, NULL, 0);
+    TraceSpan span("stop_playback", "playback");
+    if (t_streams.playing()) {
+        t_streams.stop();
+        if (audio_abandoned()) return;
         g_is_playing = false;
-        write_log(L"Playback stopped.");
+        g_stall_detector.disarm();
+        if (!g_bursting) write_log(L"Playback stopped.", LV_INFO, LC_PLAYBACK);
+    }
+}
+
+// ===== 音频线程 =====
+// 枚举器、设备和静音流都只由一个 MTA 线程持有：COM 在该线程上只初始化/反初始化一次，
+// 音频调用全部串行执行，不需要加锁。主循环通过有界命令队列同步调用它。
+//
+// 看门狗：蓝牙驱动偶尔会卡在 GetDefaultAudioEndpoint 或停止流里。每条命令有截止时间，
+// 超时后放弃这个线程（隔离：不再给它派命令，它的通知注册静音），另起一个新线程接手。
+// 被隔离的线程如果最终返回，记录实际卡住的时长后自行清理退出。
+enum AudioCmdType {
+    AC_RESOLVE_DEFAULT = 0,   // 查询默认播放设备的名称和 ID
+    AC_START = 1,             // 在 id 上开流，原来的流在新流开始播放后释放
+    AC_STOP = 2,
+    AC_CHECK_HEALTH = 3,      // 探测本进程的会话，交给 StallDetector 判定
+    AC_QUIT = 4,              // 停止播放、注销通知并退出
+    AC_PROBE_OTHERS = 5,      // 其他进程会话的峰值电平，--pause-on-audio 用
+    AC_COUNT
+};
+
+static const wchar_t* AUDIO_CMD_NAMES[AC_COUNT] = { L"resolve_default", L"start", L"stop", L"check_health", L"quit", L"probe_others" };
+static const DWORD AUDIO_DEADLINE_MS[AC_COUNT] = { 2000, 3000, 3000, 2000, 3000, 2000 };
+static const int AUDIO_MAX_QUARANTINED = 4;   // 驱动彻底卡死时不无限制地开新线程
+
+struct AudioCmd {
+    AudioCmdType type;
+    bool ok;                  // 以下为结果
+    bool underrun;
+    StallDetector::Verdict verdict;
+    float peak;
+    int sessions;
+    WCHAR id[128];
+    WCHAR name[256];
+};
+
+static const size_t AUDIO_QUEUE_CAPACITY = 8;
+
+// 命令 seq 放在 ring[seq % 容量]，执行完把结果写回原位；seq 从 1 开始。
+// 被放弃后由工作线程自己 delete。
+struct AudioOwner {
+    std::mutex m;
+    std::condition_variable cv_cmd;
+    std::condition_variable cv_done;
+    AudioCmd ring[AUDIO_QUEUE_CAPACITY];
+    uint64_t next_seq = 0;
+    uint64_t completed = 0;
+    std::atomic<bool> abandoned{ false };
+    LONGLONG hung_since_us = 0;          // 被放弃时正在执行的命令的开始时间
+    AudioCmdType hung_cmd = AC_QUIT;
+    AudioNotificationClient client;
+    std::thread thread;
+};
+
+static AudioOwner* g_audio = nullptr;   // 只由主循环线程切换
+static bool g_audio_replaced = false;   // 主循环线程：换过线程，播放状态未知，需要重启
+static std::atomic<uint64_t> g_audio_hangs[AC_COUNT];
+static std::atomic<uint64_t> g_audio_hangs_recovered(0);
+static std::atomic<int> g_audio_quarantined(0);
+static LatencyHistogram g_audio_hang_us;   // 被隔离线程最终返回时的实际卡住时长
+
+static void run_audio_cmd(AudioCmd& c) {
+    switch (c.type) {
+    case AC_RESOLVE_DEFAULT:
+        c.id[0] = c.name[0] = 0;
+        c.ok = get_default_audio_device_name(c.name, 256, c.id, 128);
+        break;
+    case AC_START:
+        c.ok = start_playback(c.id);
+        break;
+    case AC_STOP:
+    case AC_QUIT:
+        stop_playback();
+        c.ok = true;
+        break;
+    case AC_CHECK_HEALTH:
+        c.ok = observe_stream_health(c.verdict, c.underrun);
+        break;
+    case AC_PROBE_OTHERS:
+        c.ok = probe_other_sessions(c.peak, c.sessions);
+        break;
+    default:
+        break;
+    }
+}
+
+static void audio_thread_proc(AudioOwner* o) {
+    t_audio_abandoned = &o->abandoned;
+    CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    if (SUCCEEDED(CoCreateInstance(CLSID_MMDeviceEnumerator, NULL, CLSCTX_ALL, IID_PPV_ARGS(&t_audio_enum))))
+        t_audio_enum->RegisterEndpointNotificationCallback(&o->client);
+    else
+        write_log(L"Cannot create audio device enumerator.", LV_ERROR);
+
+    std::unique_lock<std::mutex> lk(o->m);
+    auto has_cmd = [o] { return o->abandoned || o->completed < o->next_seq; };
+    while (!o->abandoned) {
+        if (!t_streams.playing()) {
+            o->cv_cmd.wait(lk, has_cmd);
+        } else if (!o->cv_cmd.wait_for(lk, std::chrono::milliseconds(STREAM_REFILL_MS), has_cmd)) {
+            g_wakeups.fetch_add(1, std::memory_order_relaxed);
+            lk.unlock();
+            refill_silence(t_streams.stream());
+            lk.lock();
+            continue;
+        }
+        g_wakeups.fetch_add(1, std::memory_order_relaxed);
+        if (o->abandoned) break;
+        uint64_t seq = o->completed + 1;
+        AudioCmd c = o->ring[seq % AUDIO_QUEUE_CAPACITY];
+        lk.unlock();
+        run_audio_cmd(c);
+        lk.lock();
+        o->ring[seq % AUDIO_QUEUE_CAPACITY] = c;
+        o->completed = seq;
+        o->cv_done.notify_all();
+        if (c.type == AC_QUIT) break;
+    }
+    bool abandoned = o->abandoned;
+    LONGLONG hung_since = o->hung_since_us;
+    AudioCmdType hung_cmd = o->hung_cmd;
+    lk.unlock();
+
+    t_streams.stop();   // 被放弃的线程：卡住期间一直开着的流到这里才关
+    if (t_audio_enum) {
+        t_audio_enum->UnregisterEndpointNotificationCallback(&o->client);
+        t_audio_enum->Release();
+        t_audio_enum = nullptr;
+    }
+    CoUninitialize();
+    if (abandoned) {
+        // 卡住的调用终于返回：主循环早已换了新线程，这里只记账并释放自己
+        LONGLONG hung_us = now_us() - hung_since;
+        g_audio_hang_us.record(hung_us);
+        g_audio_hangs_recovered.fetch_add(1, std::memory_order_relaxed);
+        g_audio_quarantined.fetch_sub(1);
+        write_log(LogText(L"Quarantined audio worker returned from ") << AUDIO_CMD_NAMES[hung_cmd] << L" after " <<
+                  (uint64_t)(hung_us / 1000) << L" ms.", LV_WARN, LC_PLAYBACK);
+        o->thread.detach();
+        delete o;
+    }
+}
+
+static void spawn_audio_owner() {
+    g_audio = new AudioOwner();
+    g_audio->thread = std::thread(audio_thread_proc, g_audio);
+}
+
+// 主循环调用：入队并在截止时间内等它执行完，结果写回 c。
+// 超时则隔离当前线程并换一个新的，返回 false；队列满或已无可用线程也返回 false。
+static bool audio_call(AudioCmd& c) {
+    AudioOwner* o = g_audio;
+    if (!o) return false;
+    std::unique_lock<std::mutex> lk(o->m);
+    if (o->next_seq - o->completed >= AUDIO_QUEUE_CAPACITY) return false;
+    uint64_t seq = ++o->next_seq;
+    o->ring[seq % AUDIO_QUEUE_CAPACITY] = c;
+    o->cv_cmd.notify_one();
+    LONGLONG t0 = now_us();
+    if (o->cv_done.wait_for(lk, std::chrono::milliseconds(AUDIO_DEADLINE_MS[c.type]),
+                            [o, seq] { return o->completed >= seq; })) {
+        c = o->ring[seq % AUDIO_QUEUE_CAPACITY];
+        return true;
+    }
+
+    // 超时：正在执行的是 completed + 1 那条命令
+    AudioCmdType hung = o->ring[(o->completed + 1) % AUDIO_QUEUE_CAPACITY].type;
+    o->hung_since_us = t0;
+    o->hung_cmd = hung;
+    o->abandoned = true;
+    o->client.muted = true;
+    lk.unlock();
+    g_audio_hangs[hung].fetch_add(1, std::memory_order_relaxed);
+    int quarantined = g_audio_quarantined.fetch_add(1) + 1;
+    trace_instant("audio_hang", "watchdog");
+
+    // 被放弃的线程归它自己清理；主循环不再碰它。它的播放状态作废，由新线程重新开始
+    g_audio = nullptr;
+    g_audio_replaced = true;
+    g_is_playing = false;
+    g_stall_detector.disarm();
+    g_stream_meter.set_active(false, now_us() / 1000);
+    if (c.type == AC_QUIT) {
+        write_log(L"Audio worker hung while quitting.", LV_ERROR, LC_PLAYBACK);
+    } else if (quarantined > AUDIO_MAX_QUARANTINED) {
+        write_log(LogText(L"Audio call ") << AUDIO_CMD_NAMES[hung] << L" hung, too many quarantined workers; audio disabled until one returns.",
+                  LV_ERROR, LC_PLAYBACK);
+    } else {
+        write_log(LogText(L"Audio call ") << AUDIO_CMD_NAMES[hung] << L" hung for " << (uint64_t)AUDIO_DEADLINE_MS[c.type] <<
+                  L" ms, worker quarantined and replaced.", LV_ERROR, LC_PLAYBACK);
+        spawn_audio_owner();
+    }
+    return false;
+}
+
+// 隔离线程过多时不再派命令；等到有线程返回再恢复
+static void audio_revive() {
+    if (!g_audio && g_audio_quarantined.load() <= AUDIO_MAX_QUARANTINED) {
+        write_log(L"Audio worker restarted.", LV_WARN, LC_PLAYBACK);
+        spawn_audio_owner();
+    }
+}
+
+static bool audio_simple_call(AudioCmdType type, const wchar_t* id = nullptr) {
+    AudioCmd c = {};
+    c.type = type;
+    copy_wfield(c.id, 128, id);
+    bool ok = audio_call(c) && c.ok;
+    g_stream_meter.set_active(g_is_playing, now_us() / 1000);
+    return ok;
+}
+
+// 主循环线程调用，把占空比快照给状态页和管道线程
+static void publish_duty_cycle() {
+    int64_t now = now_us() / 1000;
+    g_duty_permille = (uint32_t)(g_stream_meter.ratio(now) * 1000 + 0.5);
+    g_stream_active_ms = (uint64_t)g_stream_meter.active_ms(now);
+}
+
+void start_audio_thread() {
+    spawn_audio_owner();
+}
+
+void stop_audio_thread() {
+    AudioOwner* o = g_audio;
+    if (!o) return;
+    if (!audio_simple_call(AC_QUIT)) return;   // QUIT 本身卡住：线程已被隔离，进程马上退出，不再等它
+    o->thread.join();
+    delete o;
+    g_audio = nullptr;
+}
+
+// 返回是否解析到默认设备；失败时 name/id 为空
+bool resolve_default_device(WCHAR* name, size_t name_len, WCHAR* id, size_t id_len) {
+    AudioCmd c = {};
+    c.type = AC_RESOLVE_DEFAULT;
+    audio_call(c);
+    wcsncpy_s(name, name_len, c.name, _TRUNCATE);
+    wcsncpy_s(id, id_len, c.id, _TRUNCATE);
+    return c.ok;
+}
+
+// 返回 true 表示需要重启播放
+bool check_stream_health() {
+    AudioCmd c = {};
+    c.type = AC_CHECK_HEALTH;
+    if (!audio_call(c) || !c.ok) return false;
+    if (c.underrun) g_counters.stream_underruns.fetch_add(1, std::memory_order_relaxed);
+    if (c.verdict != StallDetector::STALLED) return false;
+    g_counters.stream_stalls.fetch_add(1, std::memory_order_relaxed);
+    write_log(L"Keepalive stream stalled, restarting playback.", LV_WARN, LC_PLAYBACK);
+    return true;
+}
+
+// ===== 自身资源监控 =====
+// 低频采样 CPU 时间、内存、句柄数和本进程线程唤醒次数，超过阈值时告警一次，恢复时再记一条。
+// 空闲（采样窗口内没有设备通知）时唤醒率应接近 0。
+static const DWORD RESOURCE_SAMPLE_MS = 60 * 1000;
+static const double WARN_IDLE_WAKEUPS_PER_S = 2.0;
+static const double WARN_CPU_PERCENT = 1.0;
+static const uint64_t WARN_PRIVATE_BYTES = 64ull * 1024 * 1024;
+static const DWORD WARN_HANDLES = 1000;
+
+struct ResourceMonitor {
+    ULONGLONG tick;
+    uint64_t cpu_100ns;
+    uint64_t wakeups;
+    uint64_t notifications;
+    bool warn_wakeups, warn_cpu, warn_memory, warn_handles;
+};
+static ResourceMonitor g_resource = {};
+
+static uint64_t process_cpu_100ns() {
+    FILETIME create, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &create, &exit, &kernel, &user)) return 0;
+    return (((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+           (((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime);
+}
+
+static void check_threshold(bool& warned, bool over, const wchar_t* what, const wchar_t* detail) {
+    if (over && !warned) write_log(LogText(L"Resource warning: ") << what << L" " << detail, LV_WARN);
+    else if (!over && warned) write_log(LogText(L"Resource back to normal: ") << what << L" " << detail);
+    warned = over;
+}
+
+void init_resource_monitor() {
+    g_resource.tick = GetTickCount64();
+    g_resource.cpu_100ns = process_cpu_100ns();
+    g_resource.wakeups = g_wakeups.load(std::memory_order_relaxed);
+    g_resource.notifications = g_counters.notifications.load(std::memory_order_relaxed);
+}
+
+void sample_resources() {
+    ULONGLONG tick = GetTickCount64();
+    uint64_t cpu = process_cpu_100ns();
+    uint64_t wakeups = g_wakeups.load(std::memory_order_relaxed);
+    uint64_t notifications = g_counters.notifications.load(std::memory_order_relaxed);
+    double secs = (tick - g_resource.tick) / 1000.0;
+    if (secs <= 0) return;
+
+    PROCESS_MEMORY_COUNTERS_EX mem = {};
+    mem.cb = sizeof(mem);
+    GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&mem, sizeof(mem));
+    DWORD handles = 0;
+    GetProcessHandleCount(GetCurrentProcess(), &handles);
+
+    bool idle = notifications == g_resource.notifications;
+    double wakeup_rate = (wakeups - g_resource.wakeups) / secs;
+    double cpu_percent = (cpu - g_resource.cpu_100ns) / 100.0 / secs;   // 100ns → %：/1e7 * 100
+
+    wchar_t buf[128];
+    swprintf_s(buf, L"(%.2f wakeups/s idle)", wakeup_rate);
+    check_threshold(g_resource.warn_wakeups, idle && wakeup_rate > WARN_IDLE_WAKEUPS_PER_S, L"wakeup rate", buf);
+    swprintf_s(buf, L"(%.2f%% CPU)", cpu_percent);
+    check_threshold(g_resource.warn_cpu, idle && cpu_percent > WARN_CPU_PERCENT, L"CPU usage", buf);
+    swprintf_s(buf, L"(%llu KB private)", (unsigned long long)mem.PrivateUsage / 1024);
+    check_threshold(g_resource.warn_memory, mem.PrivateUsage > WARN_PRIVATE_BYTES, L"memory", buf);
+    swprintf_s(buf, L"(%lu handles)", handles);
+    check_threshold(g_resource.warn_handles, handles > WARN_HANDLES, L"handle count", buf);
+
+    g_status_data.cpu_time_ms = cpu / 10000;
+    g_status_data.private_bytes = mem.PrivateUsage;
+    g_status_data.working_set_bytes = mem.WorkingSetSize;
+    g_status_data.handle_count = handles;
+    g_status_data.wakeups = wakeups;
+
+    g_resource.tick = tick;
+    g_resource.cpu_100ns = cpu;
+    g_resource.wakeups = wakeups;
+    g_resource.notifications = notifications;
+}
+
+// ===== Prometheus textfile 导出 =====
+// --prom <file>：每 15 秒写一次 node-exporter textfile 格式。
+// 先写 <file>.tmp 再改名替换，采集端不会读到半个文件；序列化用预分配缓冲区，不做堆分配。
+static const DWORD PROM_EXPORT_MS = 15 * 1000;
+static const size_t PROM_BUF_SIZE = 32 * 1024;
+static const double PROM_HANG_BUCKETS_S[] = { 2, 5, 10, 30, 60, 300, 1800 };
+static const double PROM_LATENCY_BUCKETS_S[] = { 0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1, 2, 5, 10 };
+
+static std::wstring g_prom_path;
+static std::wstring g_prom_tmp_path;
+
+struct PromBuffer {
+    char data[PROM_BUF_SIZE];
+    size_t len;
+    bool overflow;
+
+    void printf(const char* fmt, ...) {
+        if (overflow) return;
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(data + len, sizeof(data) - len, fmt, ap);
+        va_end(ap);
+        if (n < 0 || (size_t)n >= sizeof(data) - len) overflow = true;
+        else len += (size_t)n;
+    }
+    void metric(const char* name, const char* type, const char* help) {
+        printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    }
+};
+
+static PromBuffer g_prom_buf;
+static LatencyHistogram::Snapshot g_prom_snap;
+
+void export_prometheus() {
+    if (g_prom_path.empty()) return;
+    PromBuffer& b = g_prom_buf;
+    b.len = 0;
+    b.overflow = false;
+
+    b.metric("keepalive_restarts_total", "counter", "Playback restarts handled by the main loop.");
+    b.printf("keepalive_restarts_total %llu\n", (unsigned long long)g_counters.restarts.load());
+    b.metric("keepalive_suppressed_restarts_total", "counter", "Restarts where the new device was blocked.");
+    b.printf("keepalive_suppressed_restarts_total %llu\n", (unsigned long long)g_counters.suppressed_restarts.load());
+    b.metric("keepalive_playsound_failures_total", "counter", "Silent stream starts that failed.");   // 沿用旧名，已有的看板不用改
+    b.printf("keepalive_playsound_failures_total %llu\n", (unsigned long long)g_counters.playback_failures.load());
+    b.metric("keepalive_start_retries_total", "counter", "Playback starts retried after a failure.");
+    b.printf("keepalive_start_retries_total %llu\n", (unsigned long long)g_counters.start_retries.load());
+    b.metric("keepalive_start_failure_streak", "gauge", "Consecutive failed starts on the current default device.");
+    b.printf("keepalive_start_failure_streak %u\n", g_start_streak.load());
+    b.metric("keepalive_stream_underruns_total", "counter", "Health probes that found the keepalive stream not progressing.");
+    b.printf("keepalive_stream_underruns_total %llu\n", (unsigned long long)g_counters.stream_underruns.load());
+    b.metric("keepalive_stream_stalls_total", "counter", "Keepalive streams declared stalled and restarted.");
+    b.printf("keepalive_stream_stalls_total %llu\n", (unsigned long long)g_counters.stream_stalls.load());
+    b.metric("keepalive_audio_hangs_total", "counter", "Audio calls that missed their watchdog deadline, by call.");
+    for (int i = 0; i < AC_COUNT; i++)
+        b.printf("keepalive_audio_hangs_total{call=\"%ls\"} %llu\n", AUDIO_CMD_NAMES[i], (unsigned long long)g_audio_hangs[i].load());
+    b.metric("keepalive_audio_quarantined_workers", "gauge", "Audio worker threads abandoned by the watchdog and still stuck.");
+    b.printf("keepalive_audio_quarantined_workers %d\n", g_audio_quarantined.load());
+    b.metric("keepalive_notifications_total", "counter", "Device notifications by callback type.");
+    b.printf("keepalive_notifications_total{type=\"default_changed\"} %llu\n", (unsigned long long)g_counters.notify_default_changed.load());
+    b.printf("keepalive_notifications_total{type=\"added\"} %llu\n", (unsigned long long)g_counters.notify_added.load());
+    b.printf("keepalive_notifications_total{type=\"removed\"} %llu\n", (unsigned long long)g_counters.notify_removed.load());
+    b.printf("keepalive_notifications_total{type=\"state_changed\"} %llu\n", (unsigned long long)g_counters.notify_state_changed.load());
+    b.printf("keepalive_notifications_total{type=\"property_changed\"} %llu\n", (unsigned long long)g_counters.notify_property_changed.load());
+
+    b.metric("keepalive_playing", "gauge", "1 while the silent stream is playing.");
+    b.printf("keepalive_playing %d\n", g_is_playing ? 1 : 0);
+    publish_duty_cycle();
+    b.metric("keepalive_stream_active_seconds_total", "counter", "Time the silent stream was open.");
+    b.printf("keepalive_stream_active_seconds_total %.3f\n", g_stream_active_ms.load() / 1000.0);
+    b.metric("keepalive_stream_duty_cycle", "gauge", "Fraction of time since start the silent stream was open.");
+    b.printf("keepalive_stream_duty_cycle %.3f\n", g_duty_permille.load() / 1000.0);
+    b.metric("keepalive_duty_cycle_bursts_total", "counter", "Silent bursts played in duty-cycled mode.");
+    b.printf("keepalive_duty_cycle_bursts_total %llu\n", (unsigned long long)g_counters.duty_bursts.load());
+    b.metric("keepalive_paused_for_other_audio", "gauge", "1 while keepalive is paused because another program is playing to the device.");
+    b.printf("keepalive_paused_for_other_audio %d\n", g_other_audio_paused ? 1 : 0);
+    b.metric("keepalive_other_audio_pauses_total", "counter", "Times keepalive paused because another program started playing.");
+    b.printf("keepalive_other_audio_pauses_total %llu\n", (unsigned long long)g_counters.other_audio_pauses.load());
+    b.metric("keepalive_duty_cycle_misses_total", "counter", "Bursts started after the device's idle timeout had already passed.");
+    b.printf("keepalive_duty_cycle_misses_total %llu\n", (unsigned long long)g_counters.duty_misses.load());
+    b.metric("keepalive_device_blocked", "gauge", "1 if the current default device is in the block list.");
+    b.printf("keepalive_device_blocked %u\n", g_status_data.blocked);
+
+    b.metric("keepalive_reconnect_latency_seconds", "histogram", "Reconnect latency by stage.");
+    for (int i = 0; i < LS_COUNT; i++) {
+        g_latency[i].snapshot(g_prom_snap);
+        for (double le : PROM_LATENCY_BUCKETS_S)
+            b.printf("keepalive_reconnect_latency_seconds_bucket{stage=\"%ls\",le=\"%g\"} %llu\n", LATENCY_STAGE_NAMES[i], le,
+                     (unsigned long long)g_prom_snap.count_at_or_below((int64_t)(le * 1000000)));
+        b.printf("keepalive_reconnect_latency_seconds_bucket{stage=\"%ls\",le=\"+Inf\"} %llu\n", LATENCY_STAGE_NAMES[i],
+                 (unsigned long long)g_prom_snap.total);
+        b.printf("keepalive_reconnect_latency_seconds_sum{stage=\"%ls\"} %.6f\n", LATENCY_STAGE_NAMES[i], g_prom_snap.sum / 1e6);
+        b.printf("keepalive_reconnect_latency_seconds_count{stage=\"%ls\"} %llu\n", LATENCY_STAGE_NAMES[i],
+                 (unsigned long long)g_prom_snap.total);
+    }
+    StreamPoolStats pool = stream_pool_stats();
+    b.metric("keepalive_stream_pool_lookups_total", "counter", "Stream opens that found (hit) or had to negotiate (miss) the endpoint's mix format and buffer size.");
+    b.printf("keepalive_stream_pool_lookups_total{result=\"hit\"} %llu\n", (unsigned long long)pool.hits);
+    b.printf("keepalive_stream_pool_lookups_total{result=\"miss\"} %llu\n", (unsigned long long)pool.misses);
+    b.metric("keepalive_stream_pool_evictions_total", "counter", "Cached stream configurations dropped to stay within the count and memory limits.");
+    b.printf("keepalive_stream_pool_evictions_total %llu\n", (unsigned long long)pool.evictions);
+    b.metric("keepalive_stream_pool_saved_seconds_total", "counter", "Format negotiation time skipped thanks to cached configurations.");
+    b.printf("keepalive_stream_pool_saved_seconds_total %.6f\n", pool.saved_us / 1e6);
+    b.metric("keepalive_stream_pool_entries", "gauge", "Endpoints with a cached stream configuration.");
+    b.printf("keepalive_stream_pool_entries %zu\n", pool.entries);
+    b.metric("keepalive_stream_pool_bytes", "gauge", "Memory held by cached stream configurations.");
+    b.printf("keepalive_stream_pool_bytes %zu\n", pool.bytes);
+    b.metric("keepalive_handover_seconds", "histogram",
+             "Default device handovers: new stream setup time (side=new) and how long the old stream kept playing after it (side=old).");
+    static const char* HANDOVER_SIDES[2] = { "new", "old" };
+    for (int i = 0; i < 2; i++) {
+        g_handover_us[i].snapshot(g_prom_snap);
+        for (double le : PROM_LATENCY_BUCKETS_S)
+            b.printf("keepalive_handover_seconds_bucket{side=\"%s\",le=\"%g\"} %llu\n", HANDOVER_SIDES[i], le,
+                     (unsigned long long)g_prom_snap.count_at_or_below((int64_t)(le * 1000000)));
+        b.printf("keepalive_handover_seconds_bucket{side=\"%s\",le=\"+Inf\"} %llu\n", HANDOVER_SIDES[i], (unsigned long long)g_prom_snap.total);
+        b.printf("keepalive_handover_seconds_sum{side=\"%s\"} %.6f\n", HANDOVER_SIDES[i], g_prom_snap.sum / 1e6);
+        b.printf("keepalive_handover_seconds_count{side=\"%s\"} %llu\n", HANDOVER_SIDES[i], (unsigned long long)g_prom_snap.total);
+    }
+    b.metric("keepalive_audio_hang_duration_seconds", "histogram", "How long quarantined audio calls stayed stuck before returning.");
+    g_audio_hang_us.snapshot(g_prom_snap);
+    for (double le : PROM_HANG_BUCKETS_S)
+        b.printf("keepalive_audio_hang_duration_seconds_bucket{le=\"%g\"} %llu\n", le,
+                 (unsigned long long)g_prom_snap.count_at_or_below((int64_t)(le * 1000000)));
+    b.printf("keepalive_audio_hang_duration_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)g_prom_snap.total);
+    b.printf("keepalive_audio_hang_duration_seconds_sum %.6f\n", g_prom_snap.sum / 1e6);
+    b.printf("keepalive_audio_hang_duration_seconds_count %llu\n", (unsigned long long)g_prom_snap.total);
+
+    if (b.overflow) {
+        write_log(L"Prometheus export buffer too small.", LV_ERROR);
+        return;
+    }
+    HANDLE h = CreateFileW(g_prom_tmp_path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) return;
+    DWORD written = 0;
+    BOOL ok = WriteFile(h, b.data, (DWORD)b.len, &written, NULL);
+    CloseHandle(h);
+    if (!ok || !MoveFileExW(g_prom_tmp_path.c_str(), g_prom_path.c_str(), MOVEFILE_REPLACE_EXISTING))
+        write_log(L"Prometheus export failed.", LV_ERROR);
+}
+
+// ===== 状态查询（命名管道）=====
+// 后台线程阻塞在 ConnectNamedPipe 上，每个连接写一份 JSON 后断开。
+// 只读原子量和设备名副本，不会阻塞设备事件处理。
+static const wchar_t* STATUS_PIPE_NAME = L"\\\\.\\pipe\\keepalive_log_status";
+static std::thread g_status_thread;
+static std::atomic<bool> g_status_stop(false);
+
+static void append_json_string(std::string& out, const WCHAR* w) {
+    std::string utf8;
+    append_utf8(utf8, w);
+    out += '"';
+    for (char c : utf8) {
+        if (c == '"' || c == '\\') { out += '\\'; out += c; }
+        else if ((unsigned char)c < 0x20) {
+            char esc[8];
+            sprintf_s(esc, "\\u%04x", (unsigned char)c);
+            out += esc;
+        }
+        else out += c;
+    }
+    out += '"';
+}
+
+std::string build_status_json() {
+    WCHAR device[256], id[128];
+    copy_current_device(device, 256, id, 128);
+    bool blocked = is_blocked_device(device, g_blocked);
+
+    char buf[512];
+    std::string out = "{\"device\":";
+    append_json_string(out, device);
+    out += ",\"endpoint_id\":";
+    append_json_string(out, id);
+    uint64_t hangs = 0;
+    for (int i = 0; i < AC_COUNT; i++) hangs += g_audio_hangs[i].load();
+    sprintf_s(buf, ",\"playing\":%s,\"blocked\":%s,\"uptime_s\":%llu,\"notifications\":%llu,\"restarts\":%llu,\"playback_failures\":%llu,\"start_retries\":%llu,\"stream_stalls\":%llu,\"audio_hangs\":%llu,\"quarantined_workers\":%d",
+              g_is_playing ? "true" : "false", blocked ? "true" : "false",
+              (unsigned long long)((GetTickCount64() - g_start_tick) / 1000),
+              (unsigned long long)g_counters.notifications.load(),
+              (unsigned long long)g_counters.restarts.load(),
+              (unsigned long long)g_counters.playback_failures.load(),
+              (unsigned long long)g_counters.start_retries.load(),
+              (unsigned long long)g_counters.stream_stalls.load(),
+              (unsigned long long)hangs, g_audio_quarantined.load());
+    out += buf;
+    sprintf_s(buf, ",\"stream_duty_cycle\":%.3f,\"stream_active_s\":%llu,\"duty_cycle_bursts\":%llu,\"duty_cycle_misses\":%llu,\"paused_for_other_audio\":%s,\"other_audio_pauses\":%llu",
+              g_duty_permille.load() / 1000.0, (unsigned long long)(g_stream_active_ms.load() / 1000),
+              (unsigned long long)g_counters.duty_bursts.load(), (unsigned long long)g_counters.duty_misses.load(),
+              g_other_audio_paused ? "true" : "false", (unsigned long long)g_counters.other_audio_pauses.load());
+    out += buf;
+
+    KeepaliveStatusData page = {};
+    if (g_status_map.page) keepalive_status_read(g_status_map.page, page);
+    sprintf_s(buf, ",\"cpu_time_ms\":%llu,\"private_bytes\":%llu,\"working_set_bytes\":%llu,\"handles\":%u,\"wakeups\":%llu",
+              (unsigned long long)page.cpu_time_ms, (unsigned long long)page.private_bytes,
+              (unsigned long long)page.working_set_bytes, page.handle_count, (unsigned long long)page.wakeups);
+    out += buf;
+
+    static LatencyHistogram::Snapshot snap;
+    out += ",\"latency_ms\":{";
+    for (int i = 0; i < LS_COUNT; i++) {
+        g_latency[i].snapshot(snap);
+        sprintf_s(buf, "%s\"%ls\":{\"n\":%llu,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f}",
+                  i ? "," : "", LATENCY_STAGE_NAMES[i], (unsigned long long)snap.total,
+                  snap.percentile(50) / 1000.0, snap.percentile(90) / 1000.0,
+                  snap.percentile(99) / 1000.0, snap.max() / 1000.0);
+        out += buf;
+    }
+    out += "}";
+    g_handover_us[0].snapshot(snap);
+    sprintf_s(buf, ",\"handovers\":%llu,\"handover_ms\":{\"new\":{\"p50\":%.1f,\"max\":%.1f}",
+              (unsigned long long)g_counters.handovers.load(), snap.percentile(50) / 1000.0, snap.max() / 1000.0);
+    out += buf;
+    g_handover_us[1].snapshot(snap);
+    sprintf_s(buf, ",\"old\":{\"p50\":%.1f,\"max\":%.1f}}", snap.percentile(50) / 1000.0, snap.max() / 1000.0);
+    out += buf;
+    StreamPoolStats pool = stream_pool_stats();
+    uint64_t lookups = pool.hits + pool.misses;
+    sprintf_s(buf, ",\"stream_pool\":{\"hits\":%llu,\"misses\":%llu,\"hit_rate\":%.3f,\"saved_ms\":%.1f,\"entries\":%zu,\"bytes\":%zu,\"evictions\":%llu}",
+              (unsigned long long)pool.hits, (unsigned long long)pool.misses, lookups ? (double)pool.hits / lookups : 0.0,
+              pool.saved_us / 1000.0, pool.entries, pool.bytes, (unsigned long long)pool.evictions);
+    out += buf;
+    out += "}\n";
+    return out;
+}
+
+// 最多两个实例：一个正在给客户端写 JSON，一个等下一个客户端
+static HANDLE create_status_pipe(bool first) {
+    return CreateNamedPipeW(STATUS_PIPE_NAME,
+                            PIPE_ACCESS_OUTBOUND | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+                            PIPE_TYPE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                            2, 4096, 4096, 0, NULL);
+}
+
+static void status_thread_proc() {
+    HANDLE pipe = create_status_pipe(true);
+    if (pipe == INVALID_HANDLE_VALUE) {
+        write_log(L"Status pipe unavailable (another instance running?)", LV_ERROR);
+        return;
+    }
+    while (!g_status_stop) {
+        BOOL connected = ConnectNamedPipe(pipe, NULL) || GetLastError() == ERROR_PIPE_CONNECTED;
+        g_wakeups.fetch_add(1, std::memory_order_relaxed);
+        // 先建好下一个实例再服务这个客户端：任何时候都有一个实例在等，
+        // 客户端不会在两个实例之间碰上 ERROR_FILE_NOT_FOUND 而误报没在运行
+        HANDLE next = create_status_pipe(false);
+        if (connected && !g_status_stop) {
+            std::string json = build_status_json();
+            DWORD written = 0;
+            WriteFile(pipe, json.c_str(), (DWORD)json.size(), &written, NULL);
+            FlushFileBuffers(pipe);
+        }
+        DisconnectNamedPipe(pipe);
+        CloseHandle(pipe);
+        pipe = next != INVALID_HANDLE_VALUE ? next : create_status_pipe(false);
+        if (pipe == INVALID_HANDLE_VALUE) {
+            write_log(L"Status pipe could not be recreated, --status disabled.", LV_ERROR);
+            return;
+        }
     }
+    CloseHandle(pipe);
+}
+
+void start_status_server() {
+    g_status_thread = std::thread(status_thread_proc);
+}
+
+void stop_status_server() {
+    if (!g_status_thread.joinable()) return;
+    g_status_stop = true;
+    // 线程可能刚检查完 g_status_stop 还没进 ConnectNamedPipe，这时没有可取消的 I/O。
+    // 自己连一次：等着的实例总会被连上，ConnectNamedPipe 立即返回，线程看到停止标志退出。
+    // CancelSynchronousIo 仍然保留，用来打断卡在不读数据的客户端上的 WriteFile/FlushFileBuffers
+    for (int attempt = 0; attempt < 3; attempt++) {
+        HANDLE wake = CreateFileW(STATUS_PIPE_NAME, GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, NULL);
+        if (wake != INVALID_HANDLE_VALUE) {
+            CloseHandle(wake);
+            break;
+        }
+        if (GetLastError() != ERROR_PIPE_BUSY) break;
+        WaitNamedPipeW(STATUS_PIPE_NAME, 100);
+    }
+    CancelSynchronousIo(g_status_thread.native_handle());
+    g_status_thread.join();
+}
+
+// 命令行子命令的输出：优先用重定向的 stdout，否则挂到启动它的控制台
+static HANDLE open_client_output() {
+    HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (out == NULL || out == INVALID_HANDLE_VALUE) {
+        AttachConsole(ATTACH_PARENT_PROCESS);
+        out = CreateFileW(L"CONOUT$", GENERIC_WRITE, FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    }
+    return out;
+}
+
+// --status：连到正在运行的实例，把 JSON 打印到启动它的控制台
+int run_status_client() {
+    HANDLE out = open_client_output();
+
+    HANDLE pipe = INVALID_HANDLE_VALUE;
+    for (int attempt = 0; attempt < 3; attempt++) {
+        pipe = CreateFileW(STATUS_PIPE_NAME, GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, NULL);
+        if (pipe != INVALID_HANDLE_VALUE || GetLastError() != ERROR_PIPE_BUSY) break;
+        WaitNamedPipeW(STATUS_PIPE_NAME, 1000);
+    }
+
+    DWORD written = 0;
+    if (pipe == INVALID_HANDLE_VALUE) {
+        const char* msg = "keepalive_log is not running.\r\n";
+        WriteFile(out, msg, (DWORD)strlen(msg), &written, NULL);
+        return 1;
+    }
+
+    char buf[4096];
+    DWORD n = 0;
+    while (ReadFile(pipe, buf, sizeof(buf), &n, NULL) && n > 0)
+        WriteFile(out, buf, n, &written, NULL);
+    CloseHandle(pipe);
+    return 0;
+}
+
+// --ledger：汇总账本，每个设备一行
+int run_ledger_query() {
+    HANDLE out = open_client_output();
+    DWORD written = 0;
+    std::vector<LedgerRecord> records;
+    if (!read_ledger(exe_dir_path(L"keepalive_ledger.bin"), records)) {
+        const char* msg = "No ledger file.\r\n";
+        WriteFile(out, msg, (DWORD)strlen(msg), &written, NULL);
+        return 1;
+    }
+    std::map<std::string, LedgerRecord> merged;
+    for (const auto& r : records) merge_record(merged, r);
+
+    std::string text = "device                          connected_h  kept_alive_h  blocked_h  disconnects  per_day  reconnects  avg_latency_ms  endpoint\r\n";
+    for (const auto& kv : merged) {
+        const LedgerRecord& r = kv.second;
+        double hours = r.connected_s / 3600.0;
+        char line[512];
+        sprintf_s(line, "%-30.30s  %11.1f  %12.1f  %9.1f  %11u  %7.1f  %10u  %14.1f  %s\r\n",
+                  r.device_name, hours, r.kept_alive_s / 3600.0, r.blocked_s / 3600.0, r.disconnects,
+                  hours > 0 ? r.disconnects / hours * 24 : 0.0, r.reconnects,
+                  r.reconnects ? r.reconnect_latency_us / 1000.0 / r.reconnects : 0.0, r.endpoint_id);
+        text += line;
+    }
+    WriteFile(out, text.c_str(), (DWORD)text.size(), &written, NULL);
+    return 0;
+}
+
+// ===== 播放生命周期 =====
+// 每次需要重启都启动一个生命周期协程，由主循环线程上的 g_exec 推进；新的重启取消还没走完的旧协程。
+// 协程里的等待不阻塞主循环，期间设备通知、定时任务照常处理。
+// 启动失败按退避间隔重试，直到成功或被设备变化取消；重试间隔从该设备的连续失败次数算起。
+static const int64_t DEVICE_READY_TIMEOUT_MS = 2000;
+
+static Executor g_exec;
+static Signal g_device_signal;          // 主循环应用完一批设备事件后通知
+static Signal g_playback_signal;        // 播放开始、音频线程被换掉时通知
+static CancelSource g_lifecycle_cancel;
+static Backoff g_start_backoff(Backoff::Config(), GetTickCount64());
+static FailureStreaks g_start_streaks;
+
+static int64_t exec_now() { return now_us() / 1000; }   // 与可等待定时器同样用 QPC，不受 15.6 ms 节拍影响
+
+// ===== 间歇保活 =====
+// duty_cycle_devices.txt 里配置了空闲超时的设备不持续播放：启动成功后生命周期协程按 BurstSchedule
+// 关流、等到快超时再开流播放一个 burst，直到被下一次重启取消。开流失败交回重启流程按退避重试。
+// 超时配置为 auto 的设备由 IdleTimeoutLearner 逐段加长静默去试，协程被取消时设备已不再活动就算
+// 这段静默没挺过。学到的值按 endpoint ID 存在 keepalive_idle_timeouts.bin，有变化就整个文件重写。
+static std::map<std::wstring, IdleTimeoutLearner, std::less<>> g_idle_learners;   // 只在主循环线程访问
+static std::wstring g_idle_timeouts_path;
+
+static void load_idle_timeouts() {
+    HANDLE h = CreateFileW(g_idle_timeouts_path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                           NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) return;
+    LARGE_INTEGER size;
+    GetFileSizeEx(h, &size);
+    std::vector<IdleTimeoutRecord> records((size_t)(size.QuadPart / sizeof(IdleTimeoutRecord)));
+    DWORD n = 0;
+    if (!records.empty()) ReadFile(h, records.data(), (DWORD)(records.size() * sizeof(IdleTimeoutRecord)), &n, NULL);
+    CloseHandle(h);
+    records.resize(n / sizeof(IdleTimeoutRecord));
+    for (const auto& r : records) {
+        IdleTimeoutLearner l;
+        if (l.load(r)) g_idle_learners[utf8_to_wstring(std::string(r.endpoint_id, strnlen(r.endpoint_id, sizeof(r.endpoint_id))))] = l;
+    }
+}
+
+// 写临时文件后替换
+static void save_idle_timeouts() {
+    std::vector<IdleTimeoutRecord> out;
+    for (const auto& kv : g_idle_learners) {
+        IdleTimeoutRecord r = {};
+        kv.second.save(r);
+        copy_utf8_field(r.endpoint_id, sizeof(r.endpoint_id), kv.first);
+        out.push_back(r);
+    }
+    std::wstring tmp = g_idle_timeouts_path + L".tmp";
+    HANDLE h = CreateFileW(tmp.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) {
+        write_log(L"Cannot write " + tmp, LV_ERROR);
+        return;
+    }
+    DWORD written = 0;
+    BOOL ok = WriteFile(h, out.data(), (DWORD)(out.size() * sizeof(IdleTimeoutRecord)), &written, NULL);
+    CloseHandle(h);
+    if (ok) MoveFileExW(tmp.c_str(), g_idle_timeouts_path.c_str(), MOVEFILE_REPLACE_EXISTING);
+    else DeleteFileW(tmp.c_str());
+}
+
+// 学习状态有变化就保存；刚收敛时记一条日志
+static void idle_learner_changed(IdleTimeoutLearner* learn, bool was_converged) {
+    if (!learn || !learn->take_dirty()) return;
+    save_idle_timeouts();
+    if (learn->converged() && !was_converged) {
+        DutyCyclePlan p = learn->plan();
+        if (p.enabled())
+            write_log(LogText(L"Idle timeout learned: ") << (uint64_t)learn->safe_ms() << L" ms of silence is safe, bursting after every " <<
+                      (uint64_t)p.gap_ms << L" ms.", LV_INFO, LC_PLAYBACK);
+        else
+            write_log(L"Idle timeout learned: too short for bursts, playing continuously.", LV_INFO, LC_PLAYBACK);
+    }
+}
+
+// id 是播放中的 endpoint，learn 非空时也是它在 g_idle_learners 里的键
+static Task<> duty_cycle(DutyCyclePlan plan, const wchar_t* id, IdleTimeoutLearner* learn, CancelToken tok) {
+    BurstSchedule sched(plan);
+    sched.opened(exec_now());
+    g_bursting = true;
+    g_counters.duty_bursts.fetch_add(1, std::memory_order_relaxed);
+    while (true) {
+        bool ok = co_await g_exec.sleep(sched.next_ms() - g_exec.now(), tok);
+        if (!ok) break;
+        bool was_converged = learn && learn->converged();
+        if (sched.open()) {
+            audio_simple_call(AC_STOP);
+            if (learn) {
+                learn->gap_started(exec_now());
+                DutyCyclePlan next = learn->plan(plan.burst_ms);
+                if (next.enabled()) sched.set_plan(next);
+            }
+            sched.closed(exec_now());
+            idle_learner_changed(learn, was_converged);
+            continue;
+        }
+        bool started = audio_simple_call(AC_START, id);
+        if (!started) {
+            write_log(L"Burst failed to start, restarting playback.", LV_WARN, LC_PLAYBACK);
+            g_core.set_playing(false);
+            g_core.force_restart();
+            break;
+        }
+        uint64_t misses = sched.misses();
+        sched.opened(exec_now());
+        if (learn) learn->gap_ended(exec_now());
+        idle_learner_changed(learn, was_converged);
+        g_counters.duty_bursts.fetch_add(1, std::memory_order_relaxed);
+        if (sched.misses() != misses) {
+            g_counters.duty_misses.fetch_add(1, std::memory_order_relaxed);
+            write_log(L"Burst started after the device's idle timeout.", LV_WARN, LC_PLAYBACK);
+        }
+    }
+    // 被取消时设备已经不在：静默太长，接收端休眠断开了（或者用户自己断开，学习器会分辨）。
+    // 设备还在就是别的原因重启，接手的协程马上重新开流，当作这段静默到此结束
+    if (learn) {
+        bool was_converged = learn->converged();
+        if (g_core.default_active() && wcscmp(g_core.default_id(), id) == 0) learn->gap_ended(exec_now());
+        else if (learn->device_lost(exec_now()))
+            write_log(LogText(L"Device dropped during a silence; idle timeout is at most ") << (uint64_t)learn->limit_ms() << L" ms.",
+                      LV_INFO, LC_PLAYBACK);
+        idle_learner_changed(learn, was_converged);
+    }
+    g_bursting = false;
+}
+
+// 等默认设备仍是 id 且处于活动状态；超时或被取消返回 false
+static Task<bool> device_active(const wchar_t* id, int64_t timeout_ms, CancelToken tok) {
+    co_return co_await wait_until(g_exec, g_device_signal, [id] {
+        return g_core.default_active() && wcscmp(g_core.default_id(), id) == 0;
+    }, timeout_ms, tok);
+}
+
+static Task<> playback_lifecycle(LONGLONG picked, LONGLONG notified, CancelToken tok) {
+    TraceSpan span("restart", "playback");
+    g_counters.restarts.fetch_add(1, std::memory_order_relaxed);
+    if (notified > 0) g_latency[LS_DISPATCH].record(picked - notified);
+
+    KeepAliveCore::Action action;
+    {
+        TraceSpan policy("decide", "policy");
+        action = g_core.decide();
+    }
+    g_other_audio_paused = g_core.paused();   // 换了默认设备时暂停已被取消，账本和状态页马上按新设备算
+    DutyCyclePlan duty;
+    IdleTimeoutLearner* learn = nullptr;
+    WCHAR id[DEVICE_ID_LEN] = {};
+    // 还要在（可能是另一个）设备上播放时先不停：旧流留到新流开始播放再释放，见 StreamHandover。
+    // 新流一直开不起来就在放弃时停掉
+    if (action.stop) g_core.set_playing(false);
+    if (!action.start) {
+        if (g_is_playing) audio_simple_call(AC_STOP);
+        if (g_core.blocked()) g_counters.suppressed_restarts.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        copy_wfield(id, DEVICE_ID_LEN, g_core.default_id());
+        bool ready = co_await device_active(id, DEVICE_READY_TIMEOUT_MS, tok);
+        const DutyCycleDevice* dc = find_duty_cycle_device(g_core.default_name(), g_duty_devices);
+        if (dc && dc->idle_timeout_ms) {
+            duty = plan_duty_cycle(dc->idle_timeout_ms, dc->burst_ms);
+        } else if (dc) {
+            learn = &g_idle_learners.try_emplace(id).first->second;
+            duty = learn->plan(dc->burst_ms);
+        }
+        g_start_streak = g_start_streaks.get(id, exec_now());
+        while (ready) {
+            g_core.set_playing(audio_simple_call(AC_START, id));
+            if (g_core.playing()) {
+                g_exec.notify(g_playback_signal);
+                g_start_streaks.succeed(id);
+                g_start_streak = 0;
+                LONGLONG done = now_us();
+                g_latency[LS_START].record(done - picked);
+                if (notified > 0) g_latency[LS_TOTAL].record(done - notified);
+                break;
+            }
+            if (g_audio_replaced) break;   // 音频线程被换掉，主循环会取消本协程重新决策
+            uint32_t streak = g_start_streaks.fail(id, exec_now());
+            int64_t delay = g_start_backoff.delay(streak - 1);
+            g_start_streak = streak;
+            g_counters.start_retries.fetch_add(1, std::memory_order_relaxed);
+            write_log(LogText(L"Start failed ") << (uint64_t)streak << L" time(s) in a row, retrying in " <<
+                      (uint64_t)delay << L" ms.", LV_WARN, LC_PLAYBACK);
+            ready = co_await g_exec.sleep(delay, tok);   // 默认设备变化时被取消
+        }
+        if (!ready && !tok.cancelled()) {
+            if (g_is_playing) audio_simple_call(AC_STOP);   // 旧设备上的流
+            write_log(LogText(L"Device not ready, playback not started: ") << id, LV_ERROR, LC_DEVICE);
+        }
+    }
+    if (tok.cancelled()) co_return;   // 取代它的协程负责更新账本和状态页
+    update_ledger_state();
+    if (notified > 0 && g_core.playing()) ledger_note_reconnect(now_us() - notified);
+    publish_status();
+    if (!g_core.playing() || !duty.enabled()) co_return;
+    if (learn && !learn->converged())
+        write_log(LogText(L"Learning idle timeout: trying ") << (uint64_t)duty.gap_ms << L" ms of silence.", LV_INFO, LC_PLAYBACK);
+    else
+        write_log(LogText(L"Duty-cycled keepalive: ") << (uint64_t)duty.burst_ms << L" ms burst after every " <<
+                  (uint64_t)duty.gap_ms << L" ms of silence.", LV_INFO, LC_PLAYBACK);
+    co_await duty_cycle(duty, id, learn, tok);
+}
+
+// ===== 定时任务 =====
+// 周期任务也是 g_exec 上的协程，到期时间都在同一个时间轮里，主循环只按最近的一个设置可等待定时器。
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+// 第一次在 first_ms 后运行，之后每次运行完隔 period_ms 再运行
+static Task<> periodic(int64_t first_ms, int64_t period_ms, void (*job)(), CancelToken tok) {
+    int64_t delay = first_ms;
+    while (true) {
+        bool ok = co_await g_exec.sleep(delay, tok);
+        if (!ok) break;
+        job();
+        delay = period_ms;
+    }
+}
+
+static void sample_tick() {
+    sample_resources();
+    publish_duty_cycle();
+    publish_status();
+    flush_event_recorder();
+}
+
+// 只在持续播放中（或音频线程不可用、需要 audio_revive）时探测，停着或间歇保活时不定时唤醒
+static bool health_probe_wanted() { return (g_core.playing() && !g_bursting) || !g_audio; }
+
+static Task<> health_loop(CancelToken tok) {
+    while (true) {
+        bool ok = co_await wait_until(g_exec, g_playback_signal, health_probe_wanted, TASK_NO_DEADLINE, tok);
+        if (ok) ok = co_await g_exec.sleep(HEALTH_PROBE_MS, tok);
+        if (!ok) break;
+        if (!health_probe_wanted()) continue;
+        audio_revive();
+        if (check_stream_health()) g_core.force_restart();
+    }
+}
+
+// --pause-on-audio：保活中或暂停中每 probe_ms 看一次默认设备上其他会话的电平，由 OtherAudioDetector 决定暂停/恢复。
+// 暂停和恢复都走一次重启，由生命周期协程停止或重新开始播放
+static bool g_pause_on_audio = false;
+static OtherAudioDetector g_other_audio;
+
+static bool other_audio_watched() { return g_core.playing() || g_core.paused(); }
+
+static Task<> other_audio_loop(CancelToken tok) {
+    while (true) {
+        bool ok = co_await wait_until(g_exec, g_playback_signal, other_audio_watched, TASK_NO_DEADLINE, tok);
+        if (ok) ok = co_await g_exec.sleep(g_other_audio.config().probe_ms, tok);
+        if (!ok) break;
+        if (!other_audio_watched()) continue;
+        AudioCmd c = {};
+        c.type = AC_PROBE_OTHERS;
+        bool probed = audio_call(c) && c.ok;
+        bool was = g_core.paused();
+        bool paused = g_core.apply_other_audio(g_other_audio, exec_now(), probed ? c.peak : 0.0f, probed ? c.sessions : 0);
+        g_other_audio_paused = paused;   // 换默认设备取消的暂停也要跟上
+        if (paused == was) continue;
+        if (paused) {
+            g_counters.other_audio_pauses.fetch_add(1, std::memory_order_relaxed);
+            write_log(LogText(L"Other audio playing (") << (uint64_t)c.sessions << L" session(s)), keepalive paused.", LV_INFO, LC_PLAYBACK);
+        } else {
+            write_log(L"Device quiet again, keepalive resumed.", LV_INFO, LC_PLAYBACK);
+        }
+    }
+}
+
+static void start_timer_jobs(CancelSource& jobs) {
+    g_exec.spawn(periodic(RESOURCE_SAMPLE_MS, RESOURCE_SAMPLE_MS, sample_tick, CancelToken(jobs)));
+    g_exec.spawn(periodic(LATENCY_REPORT_MS, LATENCY_REPORT_MS, [] { report_latency(false); }, CancelToken(jobs)));
+    g_exec.spawn(periodic(LEDGER_FLUSH_MS, LEDGER_FLUSH_MS, flush_ledger, CancelToken(jobs)));
+    if (!g_prom_path.empty()) g_exec.spawn(periodic(0, PROM_EXPORT_MS, export_prometheus, CancelToken(jobs)));
+    g_exec.spawn(health_loop(CancelToken(jobs)));
+    if (g_pause_on_audio) g_exec.spawn(other_audio_loop(CancelToken(jobs)));
+}
+
+// 把可等待定时器设到 deadline（exec_now() 的时间），TASK_NO_DEADLINE 表示取消
+static void arm_wait_timer(HANDLE timer, int64_t deadline) {
+    if (deadline == TASK_NO_DEADLINE) {
+        CancelWaitableTimer(timer);
+        return;
+    }
+    int64_t ms = deadline - exec_now();
+    LARGE_INTEGER due;
+    due.QuadPart = ms > 0 ? -ms * 10000 : -1;   // 负数为相对时间，单位 100 ns
+    SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE);
 }
 
 // ===== 主入口 =====
-int WINAPI wWinMain(HINSTANCE, HINSTANCE, PWSTR lpCmdLine, int) {
-    std::wstring args = lpCmdLine ? lpCmdLine : L"";
-    bool has_console = args.find(L"--console") != std::wstring::npos || args.find(L"-c") != std::wstring::npos;
-    bool has_verbose = args.find(L"--verbose") != std::wstring::npos || args.find(L"-v") != std::wstring::npos;
+// 控制台 Ctrl+C / 关闭窗口：通知主循环退出，等它写完统计和日志再返回
+BOOL WINAPI console_ctrl_handler(DWORD) {
+    SetEvent(g_quit_event);
+    WaitForSingleObject(g_main_done_event, 5000);
+    return TRUE;
+}
+
+int WINAPI wWinMain(HINSTANCE, HINSTANCE, PWSTR, int) {
+    init_clock();
+    g_start_tick = GetTickCount64();
+    g_restart_event = CreateEventW(NULL, FALSE, FALSE, NULL);
+    g_quit_event = CreateEventW(NULL, TRUE, FALSE, NULL);
+    g_main_done_event = CreateEventW(NULL, TRUE, FALSE, NULL);
+
+    bool has_console = false;
+    bool has_verbose = false;
+    bool status_query = false;
+    bool ledger_query = false;
+    std::wstring trace_path;
+    std::wstring record_path;
+
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    for (int i = 1; argv && i < argc; i++) {
+        std::wstring a = argv[i];
+        if (a == L"-c" || a == L"--console") has_console = true;
+        else if (a == L"-v" || a == L"--verbose") has_verbose = true;
+        else if (a == L"--trace" && i + 1 < argc) trace_path = argv[++i];
+        else if (a == L"--prom" && i + 1 < argc) g_prom_path = argv[++i];
+        else if (a == L"--record-events" && i + 1 < argc) record_path = argv[++i];
+        else if (a == L"--status") status_query = true;
+        else if (a == L"--ledger") ledger_query = true;
+        else if (a == L"--pause-on-audio") g_pause_on_audio = true;
+    }
+    if (argv) LocalFree(argv);
+    if (status_query) return run_status_client();
+    if (ledger_query) return run_ledger_query();
+    g_ledger_path = exe_dir_path(L"keepalive_ledger.bin");
+    g_idle_timeouts_path = exe_dir_path(L"keepalive_idle_timeouts.bin");
+    if (!g_prom_path.empty()) g_prom_tmp_path = g_prom_path + L".tmp";
 
     if (has_console && has_verbose) g_mode = LOG_BOTH;
     else if (has_console) g_mode = LOG_CONSOLE;
@@ -249,41 +2239,144 @@ int WINAPI wWinMain(HINSTANCE, HINSTANCE, PWSTR lpCmdLine, int) {
         AllocConsole();
         SetConsoleOutputCP(CP_UTF8);
         SetConsoleCP(CP_UTF8);
-        freopen("CONOUT$", "w", stdout);
-        freopen("CONOUT$", "w", stderr);
-        _setmode(_fileno(stdout), _O_TEXT);
-        _setmode(_fileno(stderr), _O_TEXT);
+        SetConsoleCtrlHandler(console_ctrl_handler, TRUE);
     }
+    start_logger();
 
     write_log(L"KeepAlive started.");
+    if (!trace_path.empty()) {
+        if (start_trace(trace_path)) write_log(L"Tracing to " + trace_path);
+        else write_log(L"Cannot open trace file " + trace_path, LV_ERROR);
+    }
+    if (!record_path.empty()) {
+        if (start_event_recorder(record_path)) write_log(L"Recording device events to " + record_path);
+        else write_log(L"Cannot open event record file " + record_path, LV_ERROR);
+    }
     g_blocked = read_blocked_devices("blocked_devices.txt");
     write_log(L"Loaded blocked device list.");
+    size_t duty_skipped = 0;
+    g_duty_devices = read_duty_cycle_devices("duty_cycle_devices.txt", &duty_skipped);
+    load_idle_timeouts();
+    if (!g_duty_devices.empty() || duty_skipped)
+        write_log(LogText(L"Loaded duty-cycle device list: ") << (uint64_t)g_duty_devices.size() << L" device(s), " <<
+                  (uint64_t)duty_skipped << L" malformed line(s) skipped.", duty_skipped ? LV_WARN : LV_INFO);
+    g_event_batch.reserve(EVENT_QUEUE_CAPACITY);
 
-    CoInitialize(NULL);
-    IMMDeviceEnumerator* pEnum = nullptr;
-    CoCreateInstance(CLSID_MMDeviceEnumerator, NULL, CLSCTX_ALL, IID_PPV_ARGS(&pEnum));
+    start_audio_thread();
 
-    AudioNotificationClient client;
-    pEnum->RegisterEndpointNotificationCallback(&client);
+    WCHAR initial[256] = L"", initial_id[128] = L"";
+    resolve_default_device(initial, 256, initial_id, 128);
+    {
+        std::lock_guard<std::mutex> lk(g_device_mutex);
+        wcscpy_s(g_last_device, initial);
+        wcscpy_s(g_last_device_id, initial_id);
+    }
+    write_log(L"Initial device -> " + std::wstring(initial));
+    g_core.set_default(initial_id, initial);
+    record_event(make_device_event(now_us(), EV_DEFAULT_CHANGED, initial_id, DEVICE_STATE_ACTIVE, initial));
 
-    get_default_audio_device_name(g_last_device, 256);
-    write_log(L"Initial device -> " + std::wstring(g_last_device));
+    // 初次播放也交给生命周期协程，失败同样按退避重试
+    if (g_core.should_play()) g_core.force_restart();
 
-    // 初次播放
-    if (!is_blocked_device(g_last_device, g_blocked)) start_playback();
+    update_ledger_state();
+    init_resource_monitor();
+    if (keepalive_status_map(g_status_map, true)) {
+        g_status_data.start_unix_ms = unix_ms_now();
+        publish_status();
+    } else {
+        write_log(L"Shared status page unavailable (another instance is publishing).", LV_ERROR);
+    }
+    start_status_server();
+
+    // 高精度定时器需要 Windows 10 1803，更早的系统用普通的可等待定时器
+    HANDLE wait_timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!wait_timer) wait_timer = CreateWaitableTimerW(NULL, FALSE, NULL);
+    CancelSource timer_jobs;
+    start_timer_jobs(timer_jobs);
+    g_exec.run(exec_now());
 
+    HANDLE waits[3] = { g_quit_event, g_restart_event, wait_timer };
+    int64_t armed = TASK_NO_DEADLINE;
     while (true) {
-        Sleep(200);
+        int64_t due = g_exec.next_deadline();
+        DWORD timeout = g_core.pending() || g_audio_replaced || g_exec.has_ready() ? 0 : INFINITE;
+        if (wait_timer) {
+            if (due != armed) arm_wait_timer(wait_timer, due);
+            armed = due;
+        } else if (due != TASK_NO_DEADLINE && timeout) {
+            int64_t ms = due - exec_now();
+            timeout = ms > 0 ? (DWORD)ms : 0;
+        }
+        DWORD r = WaitForMultipleObjects(wait_timer ? 3 : 2, waits, FALSE, timeout);
+        g_wakeups.fetch_add(1, std::memory_order_relaxed);
+        if (r == WAIT_OBJECT_0) break;
+        if (r == WAIT_OBJECT_0 + 2) armed = TASK_NO_DEADLINE;   // 已触发，下一轮重新设置
 
-        if (g_need_restart) {
-            stop_playback();
-            if (!is_blocked_device(g_last_device, g_blocked)) start_playback();
-            g_need_restart = false;
+        LONGLONG picked = now_us();
+        g_event_batch.clear();
+        bool overflow = g_events.drain(g_event_batch);
+        bool default_changed = overflow;
+        for (const DeviceEvent& e : g_event_batch)
+            if (e.type == EV_DEFAULT_CHANGED) default_changed = true;
+        if (default_changed) {
+            // 一批通知只解析一次默认设备；队列溢出丢过事件时也重新查询，不依赖残缺的事件序列
+            WCHAR cur[256] = L"", cur_id[128] = L"";
+            resolve_default_device(cur, 256, cur_id, 128);
+            g_latency[LS_RESOLVE].record(now_us() - picked);
+            {
+                std::lock_guard<std::mutex> lk(g_device_mutex);
+                wcscpy_s(g_last_device, cur);
+                wcscpy_s(g_last_device_id, cur_id);
+            }
+            write_log(LogText(L"Device changed -> ") << cur, LV_INFO, LC_DEVICE);
+            for (DeviceEvent& e : g_event_batch) {
+                if (e.type != EV_DEFAULT_CHANGED) continue;
+                copy_wfield(e.id, DEVICE_ID_LEN, cur_id);
+                copy_wfield(e.name, DEVICE_NAME_LEN, cur);
+            }
+            if (overflow)
+                g_event_batch.push_back(make_device_event(now_us(), EV_DEFAULT_CHANGED, cur_id, DEVICE_STATE_ACTIVE, cur));
+        }
+        for (const DeviceEvent& e : g_event_batch) {
+            record_event(e);
+            g_core.apply(e);
         }
+        if (!g_event_batch.empty()) g_exec.notify(g_device_signal);
+
+        if (g_audio_replaced) {
+            // 看门狗换过音频线程：之前的播放状态作废，重新决策一次
+            g_audio_replaced = false;
+            g_core.set_playing(false);
+            g_core.force_restart();
+            g_exec.notify(g_playback_signal);
+        }
+
+        if (g_core.pending()) {
+            g_exec.cancel(g_lifecycle_cancel);
+            g_exec.spawn(playback_lifecycle(picked, g_notify_us.exchange(0), CancelToken(g_lifecycle_cancel)));
+        } else if (!g_event_batch.empty()) {
+            g_notify_us.store(0);   // 与当前默认设备无关的通知，不计入重连延迟
+        }
+        g_exec.run(exec_now());
     }
 
-    pEnum->UnregisterEndpointNotificationCallback(&client);
-    pEnum->Release();
-    CoUninitialize();
+    stop_status_server();
+    g_exec.cancel(g_lifecycle_cancel);
+    g_exec.cancel(timer_jobs);
+    g_exec.run(exec_now());
+    if (wait_timer) CloseHandle(wait_timer);
+    stop_audio_thread();   // 停止播放并注销设备通知
+    publish_status();
+    keepalive_status_unmap(g_status_map);
+    ledger_set_state(L"", L"", LG_NONE);
+    flush_ledger();
+    export_prometheus();
+    report_latency(true);
+    write_log(L"KeepAlive exiting.");
+
+    stop_event_recorder();
+    stop_trace();
+    stop_logger();
+    SetEvent(g_main_done_event);
     return 0;
 }
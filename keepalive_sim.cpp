@@ -0,0 +1,1957 @@
+// keepalive_sim.cpp
+// 离线仿真：把 keepalive_core.h 的 KeepAliveCore 放在虚拟时钟和模拟播放后端上驱动，不依赖 Windows：
+//   g++ -std=c++20 -O2 -pthread keepalive_sim.cpp -o keepalive_sim
+//   cl keepalive_sim.cpp /Fe:keepalive_sim.exe /std:c++20 /O2 /EHsc
+//
+// 用法：
+//   keepalive_sim replay <events.bin> [--speed 1000] [--blocked blocked_devices.txt] [--restart-cost-ms 30]
+//     重放 keepalive_log.exe --record-events 录下的设备事件。虚拟时间按 speed 倍速走（0 表示不等待），
+//     报告发出的重启次数、没有在播放的时间和每个事件的决策耗时。
+//   keepalive_sim stress [--endpoints 4096] [--threads 4] [--events 1000000] [--queue 256]
+//     多个线程并发翻转大量模拟 endpoint 的状态并投递回调事件，主线程按 keepalive_log 主循环的方式消费。
+//     报告吞吐量、队列高水位、内存增长，并检查最终的播放决定是否与模拟枚举器的真实状态一致（不一致返回 2）。
+//   keepalive_sim soak [--transitions 5000000] [--endpoints 8] [--samples 50]
+//     单线程在虚拟时钟上跑数百万次设备状态变化，每个事件走一遍与 keepalive_log 相同的日志格式化，
+//     定期采样堆上存活字节数、存活块数、每事件分配次数和句柄数；任何一项持续增长则返回 2。
+//   keepalive_sim allocs [--warmup 10000] [--events 100000]
+//     同样的事件路径预热后，再处理 events 个事件期间 operator new 必须一次都没有被调用，否则返回 2。
+//   keepalive_sim lifecycle [--devices 10000] [--hours 24] [--ready-timeout-ms 2000]
+//     每个模拟 endpoint 一个生命周期协程（再加一个驱动它连接、就绪、断开的协程），全部挂在同一个
+//     单线程执行器上按虚拟时钟推进。设备刚变为活动时音频引擎常常还没准备好，启动会失败几次，
+//     生命周期协程按 keepalive_core.h 的 Backoff 重试，设备断开则放弃重试。
+//     检查每个时刻活动设备都在播放或正在重试、不活动的都已停止，关闭后协程和定时器全部回收；
+//     违反任何一项返回 2。另外报告从变为活动到真正开始播放的延迟。
+//   keepalive_sim dutycycle [--devices 1000] [--hours 24] [--late-ms 50]
+//     每个模拟设备按一行 duty_cycle_devices.txt 配置（空闲超时 3~60 s，burst 长度各不相同）解析出
+//     DutyCyclePlan，再用与 keepalive_log 相同的 BurstSchedule 在虚拟时钟上开关流；执行器每次都晚醒
+//     0~late-ms 毫秒。检查没有一次静默超过设备的空闲超时、晚醒不累积，测得的占空比与计划一致，
+//     超时太短的设备退回持续播放；违反任何一项返回 2。
+//   keepalive_sim learn [--devices 1000] [--hours 24] [--restart-hours 6] [--late-ms 50]
+//     每个模拟设备有一个随机的、程序看不到的空闲超时（3 s~5 min，也有不会休眠的），静默达到它就休眠，
+//     系统再过 0~2 s 发出设备移除；用户也会偶尔自己关掉耳机，过一会儿再连上。每个设备按
+//     IdleTimeoutLearner 试探静默长度，与 keepalive_log 的 duty_cycle() 相同。每隔 restart-hours
+//     模拟一次进程重启：学到的状态按 keepalive_idle_timeouts.bin 的记录格式序列化再读回。
+//     检查全部收敛、收敛后的静默都短于真实超时且没有再因超时断开、读回的状态一致，
+//     学到的间隔平均不低于真实超时的 60%；违反任何一项返回 2。
+//   keepalive_sim otheraudio [--listeners 200] [--hours 24]
+//     每个模拟听众有一条别的程序的播放时间线：一首接一首的歌（开头有很轻的前奏，中间偶尔有几十毫秒掉到 0），
+//     歌与歌之间 1~3 s 静音，用户随时暂停几秒到几十分钟，空闲时有短促的提示音。每 probe_ms 用
+//     OtherAudioDetector 采一次峰值电平决定是否暂停保活，与 keepalive_log --pause-on-audio 相同。
+//     歌曲、曲间和提示音期间别的程序有一个活动会话，暂停和空闲时没有。暂停中偶尔切换默认设备
+//     （音乐跟着换到新设备），保活要马上恢复、状态标志跟着清掉，并在几次探测内重新暂停。
+//     检查设备没有一次超过 10 s 既没有我们的流也没有别的流、歌曲中途没有误恢复、提示音没有触发暂停，
+//     响亮的音乐期间至少 95% 的时间保活处于暂停；违反任何一项返回 2。
+//   keepalive_sim handover [--sinks 4] [--switches 100000]
+//     在几个模拟 endpoint 之间反复切换默认设备（也有同一设备上的重建），用 keepalive_core.h 的
+//     StreamHandover 驱动模拟流后端：开流要花 2~150 ms，刚切过去的设备有时要过一会儿才开得起来，
+//     关流也要时间。逐个记录每路流开始和结束的虚拟时刻，检查第一次开流之后没有任何一段时间一路流都没有、
+//     同时最多两路、每次切换的重叠时长不为负、停止后没有泄漏的流；同样的切换序列再用先停后开跑一遍
+//     作对照，它必须测出断流（说明检查本身有效）。违反任何一项返回 2。
+//   keepalive_sim streampool [--endpoints 40] [--reconnects 1000000] [--max-entries 16] [--max-bytes 8192]
+//     按少数几个常用、多数偶尔用的分布让模拟 endpoint 反复重连，每次开流先查 keepalive_core.h 的
+//     StreamConfigPool，未命中才花 0.5~20 ms 协商格式；偶尔有设备改了格式，缓存的格式初始化失败后重新协商。
+//     每一步都对照一份朴素的 LRU 模型检查淘汰顺序，检查条目数和占用不超限、占用与条目一致、
+//     每次改格式最多失败一次、只有真正用上的缓存格式才记命中和省下的时间；违反任何一项返回 2。
+//     报告命中率和省下的协商时间。
+//   keepalive_sim statuspage [--readers 4] [--seconds 5]
+//     一个写线程不停地用 keepalive_status_publish 发布自洽的快照（所有计数都等于同一个序号，设备名和 ID
+//     也由它生成），readers 个线程同时用 keepalive_status_read 读取并检查每个快照是否自洽、序号不倒退。
+//     状态页用 keepalive_status_map 真实映射（映射不了时退回进程内的页）。开始前先让一个写端写到一半崩溃，
+//     留下状态页和一个一直开着的读视图，检查新写端接手后 seq 接着往上加、旧读视图看到新快照，
+//     并检查写端还活着时第二个写端被拒绝。有任何撕裂或倒退的快照、或接手失败返回 2。
+//   keepalive_sim histogram [--samples 1000000]
+//     往 LatencyHistogram 里记每个桶边界两侧的值和随机值（微秒到小时），再拿每个桶的上下界、
+//     100 ms SLO 和 Prometheus 的 le 边界问 count_at_or_below，和排好序的原始样本对照：
+//     结果多于真实个数（le 语义被破坏）、在桶上界处不精确、或少得超过跨界那个桶的样本数都返回 2。
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "keepalive_core.h"
+#include "keepalive_stats.h"
+#include "keepalive_status.h"
+#include "keepalive_task.h"
+#include "keepalive_util.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <dirent.h>
+#endif
+
+// ===== 分配计数 =====
+// 替换全局 operator new/delete：每块前面放 16 字节记录大小，统计分配次数和尚未释放的字节数/块数。
+// new[]、nothrow 版本默认都转到这两个函数。
+static const size_t ALLOC_HEADER = 16;
+static std::atomic<uint64_t> g_alloc_count(0);
+static std::atomic<int64_t> g_alloc_live_bytes(0);
+static std::atomic<int64_t> g_alloc_live_blocks(0);
+
+void* operator new(size_t n) {
+    unsigned char* p = (unsigned char*)malloc(n + ALLOC_HEADER);
+    if (!p) throw std::bad_alloc();
+    *(size_t*)p = n;
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    g_alloc_live_bytes.fetch_add((int64_t)n, std::memory_order_relaxed);
+    g_alloc_live_blocks.fetch_add(1, std::memory_order_relaxed);
+    return p + ALLOC_HEADER;
+}
+
+void operator delete(void* p) noexcept {
+    if (!p) return;
+    unsigned char* block = (unsigned char*)p - ALLOC_HEADER;
+    g_alloc_live_bytes.fetch_sub((int64_t)*(size_t*)block, std::memory_order_relaxed);
+    g_alloc_live_blocks.fetch_sub(1, std::memory_order_relaxed);
+    free(block);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+static const uint32_t SIM_STATE_ACTIVE = 1;       // DEVICE_STATE_ACTIVE
+static const uint32_t SIM_STATE_NOTPRESENT = 4;   // DEVICE_STATE_NOTPRESENT
+static const uint32_t SIM_STATE_UNPLUGGED = 8;    // DEVICE_STATE_UNPLUGGED
+
+// 常驻内存字节数，取不到时返回 0
+static uint64_t process_rss_bytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return pmc.WorkingSetSize;
+    return 0;
+#else
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long long pages = 0, resident = 0;
+    int n = fscanf(f, "%llu %llu", &pages, &resident);
+    fclose(f);
+    return n == 2 ? resident * 4096ull : 0;
+#endif
+}
+
+// ===== 虚拟时钟 =====
+// 时间单位微秒。speed > 0 时推进虚拟时间会按比例真实等待，让重放保留事件之间的节奏。
+class SimClock {
+public:
+    explicit SimClock(double speed) : speed_(speed) {}
+
+    int64_t now_us() const { return now_; }
+    void start_at(int64_t t) { now_ = t; }
+
+    void advance_to(int64_t t) {
+        if (t <= now_) return;
+        if (speed_ > 0) std::this_thread::sleep_for(std::chrono::microseconds((int64_t)((t - now_) / speed_)));
+        now_ = t;
+    }
+
+private:
+    double speed_;
+    int64_t now_ = 0;
+};
+
+// ===== 模拟播放后端 =====
+// 停止立即生效；开始后要过 restart_cost 才真正出声，对应 PlaySound 重新打开设备的开销。
+class SimPlayback {
+public:
+    explicit SimPlayback(int64_t restart_cost_us) : restart_cost_us_(restart_cost_us) {}
+
+    void start(int64_t now) {
+        playing_ = true;
+        audible_at_ = now + restart_cost_us_;
+        starts_++;
+    }
+    void stop() {
+        playing_ = false;
+        stops_++;
+    }
+    bool playing() const { return playing_; }
+
+    // 累计 [from, to) 内没有出声的时间；wanted 表示这段时间里决策逻辑认为应该在播放
+    void account(int64_t from, int64_t to, bool wanted) {
+        if (to <= from) return;
+        int64_t silent = to - from;
+        if (playing_) {
+            int64_t audible_from = audible_at_ > from ? audible_at_ : from;
+            silent = audible_from < to ? audible_from - from : to - from;
+        }
+        not_playing_us_ += silent;
+        if (wanted) not_playing_wanted_us_ += silent;
+    }
+
+    uint64_t starts() const { return starts_; }
+    uint64_t stops() const { return stops_; }
+    int64_t not_playing_us() const { return not_playing_us_; }
+    int64_t not_playing_wanted_us() const { return not_playing_wanted_us_; }
+
+private:
+    int64_t restart_cost_us_;
+    bool playing_ = false;
+    int64_t audible_at_ = 0;
+    uint64_t starts_ = 0;
+    uint64_t stops_ = 0;
+    int64_t not_playing_us_ = 0;
+    int64_t not_playing_wanted_us_ = 0;
+};
+
+// 进程打开的句柄（POSIX 上为文件描述符）数量，取不到时返回 0
+static uint64_t process_handle_count() {
+#ifdef _WIN32
+    DWORD n = 0;
+    return GetProcessHandleCount(GetCurrentProcess(), &n) ? n : 0;
+#else
+    DIR* d = opendir("/proc/self/fd");
+    if (!d) return 0;
+    uint64_t n = 0;
+    while (readdir(d)) n++;
+    closedir(d);
+    return n > 3 ? n - 3 : 0;   // 不算 . 和 .. 以及 opendir 自己的描述符
+#endif
+}
+
+// ===== 模拟设备枚举器 =====
+// 默认播放设备取编号最小的活动 endpoint。状态变化和由此引起的默认设备变化在同一把锁内入队，
+// 队列里的事件顺序与真实状态变化顺序一致；队列溢出时消费者调用 get_default() 重新同步。
+// 活动集合用位图，状态变化不做堆分配。
+class SimEnumerator {
+public:
+    SimEnumerator(size_t endpoints, size_t blocked_every)
+        : states_(endpoints, SIM_STATE_UNPLUGGED), active_((endpoints + 63) / 64), blocked_every_(blocked_every) {}
+
+    size_t size() const { return states_.size(); }
+
+    static void endpoint_id(size_t i, wchar_t* out, size_t n) {
+        swprintf(out, n, L"{0.0.0.00000000}.{%08zx}", i);
+    }
+    void endpoint_name(size_t i, wchar_t* out, size_t n) const {
+        bool blocked = blocked_every_ && i % blocked_every_ == blocked_every_ - 1;
+        swprintf(out, n, blocked ? L"Headphones (Blocked %zu)" : L"Speakers (Endpoint %zu)", i);
+    }
+
+    // 回调线程调用：改状态并投递 OnDeviceStateChanged，默认设备变了再投递 OnDefaultDeviceChanged
+    void set_state(size_t i, uint32_t state, int64_t t_us, EventQueue& q) {
+        std::lock_guard<std::mutex> lk(m_);
+        if (states_[i] == state) return;
+        states_[i] = state;
+        if (state == SIM_STATE_ACTIVE) active_[i / 64] |= 1ull << (i % 64);
+        else active_[i / 64] &= ~(1ull << (i % 64));
+        wchar_t id[DEVICE_ID_LEN], name[DEVICE_NAME_LEN];
+        endpoint_id(i, id, DEVICE_ID_LEN);
+        q.push(make_device_event(t_us, EV_STATE_CHANGED, id, state));
+        size_t def = first_active();
+        if (def != default_) {
+            default_ = def;
+            fill_default(id, name);
+            q.push(make_device_event(t_us, EV_DEFAULT_CHANGED, id, SIM_STATE_ACTIVE, name));
+        }
+    }
+
+    // 相当于 get_default_audio_device_name()；没有默认设备时 id 为空
+    void get_default(wchar_t* id, wchar_t* name) {
+        std::lock_guard<std::mutex> lk(m_);
+        fill_default(id, name);
+    }
+
+private:
+    size_t first_active() const {
+        for (size_t w = 0; w < active_.size(); w++) {
+            if (!active_[w]) continue;
+            size_t b = 0;
+            while (!(active_[w] >> b & 1)) b++;
+            return w * 64 + b;
+        }
+        return SIZE_MAX;
+    }
+
+    void fill_default(wchar_t* id, wchar_t* name) const {
+        id[0] = name[0] = 0;
+        if (default_ == SIZE_MAX) return;
+        endpoint_id(default_, id, DEVICE_ID_LEN);
+        endpoint_name(default_, name, DEVICE_NAME_LEN);
+    }
+
+    std::mutex m_;
+    std::vector<uint32_t> states_;
+    std::vector<uint64_t> active_;
+    size_t default_ = SIZE_MAX;
+    size_t blocked_every_;
+};
+
+// ===== replay =====
+static bool read_file(const char* path, std::string& out) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) return false;
+    std::stringstream ss;
+    ss << f.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+static int run_replay(int argc, char** argv) {
+    const char* trace_path = nullptr;
+    const char* blocked_path = nullptr;
+    double speed = 1000.0;
+    double restart_cost_ms = 30.0;
+    bool usage = false;
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--speed" && i + 1 < argc) speed = atof(argv[++i]);
+        else if (a == "--blocked" && i + 1 < argc) blocked_path = argv[++i];
+        else if (a == "--restart-cost-ms" && i + 1 < argc) restart_cost_ms = atof(argv[++i]);
+        else if (!trace_path && a[0] != '-') trace_path = argv[i];
+        else usage = true;
+    }
+    if (usage || !trace_path) {
+        fprintf(stderr, "usage: %s replay <events.bin> [--speed x] [--blocked file] [--restart-cost-ms ms]\n", argv[0]);
+        return 1;
+    }
+
+    std::string data;
+    std::vector<DeviceEvent> events;
+    if (!read_file(trace_path, data) || !parse_event_trace(data, events)) {
+        fprintf(stderr, "cannot read event trace %s\n", trace_path);
+        return 1;
+    }
+    if (events.empty()) {
+        fprintf(stderr, "event trace %s is empty\n", trace_path);
+        return 1;
+    }
+    std::vector<std::wstring> blocked;
+    if (blocked_path) blocked = read_blocked_devices(blocked_path);
+
+    KeepAliveCore core(&blocked);
+    SimClock clock(speed);
+    SimPlayback playback((int64_t)(restart_cost_ms * 1000));
+    LatencyHistogram decision_ns;
+    uint64_t by_type[6] = {};
+    uint64_t restarts = 0, suppressed = 0;
+
+    clock.start_at(events.front().t_us);
+    auto wall0 = std::chrono::steady_clock::now();
+    for (const DeviceEvent& e : events) {
+        int64_t before = clock.now_us();
+        clock.advance_to(e.t_us);
+        playback.account(before, clock.now_us(), core.should_play());
+        if (e.type < 6) by_type[e.type]++;
+
+        auto t0 = std::chrono::steady_clock::now();
+        core.apply(e);
+        bool pending = core.pending();
+        KeepAliveCore::Action action = core.decide();
+        auto t1 = std::chrono::steady_clock::now();
+        decision_ns.record(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+        if (!pending) continue;
+
+        // 与主循环一致：每次处理挂起的重启都计数，被阻止的设备不启动
+        restarts++;
+        if (action.stop) playback.stop();
+        if (action.start) playback.start(clock.now_us());
+        else if (core.blocked()) suppressed++;
+        core.set_playing(playback.playing());
+    }
+    auto wall1 = std::chrono::steady_clock::now();
+
+    double span_s = (events.back().t_us - events.front().t_us) / 1e6;
+    double wall_s = std::chrono::duration_cast<std::chrono::milliseconds>(wall1 - wall0).count() / 1000.0;
+    LatencyHistogram::Snapshot snap;
+    decision_ns.snapshot(snap);
+    printf("events            %zu (default_changed %llu, removed %llu, state_changed %llu, added %llu, property %llu)\n",
+           events.size(), (unsigned long long)by_type[EV_DEFAULT_CHANGED], (unsigned long long)by_type[EV_REMOVED],
+           (unsigned long long)by_type[EV_STATE_CHANGED], (unsigned long long)by_type[EV_ADDED],
+           (unsigned long long)by_type[EV_PROPERTY_CHANGED]);
+    printf("span              %.1f s virtual, %.2f s wall\n", span_s, wall_s);
+    printf("restarts issued   %llu (stops %llu, starts %llu, blocked %llu)\n", (unsigned long long)restarts,
+           (unsigned long long)playback.stops(), (unsigned long long)playback.starts(), (unsigned long long)suppressed);
+    printf("not playing       %.3f s (%.3f s while a usable device was default)\n",
+           playback.not_playing_us() / 1e6, playback.not_playing_wanted_us() / 1e6);
+    printf("decision latency  p50 %llu ns, p99 %llu ns, max %llu ns\n", (unsigned long long)snap.percentile(50),
+           (unsigned long long)snap.percentile(99), (unsigned long long)snap.max());
+    return 0;
+}
+
+// ===== stress =====
+static int64_t steady_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int run_stress(int argc, char** argv) {
+    size_t endpoints = 4096, threads = 4, queue_cap = 256;
+    uint64_t total_events = 1000000;
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--endpoints" && i + 1 < argc) endpoints = (size_t)atoll(argv[++i]);
+        else if (a == "--threads" && i + 1 < argc) threads = (size_t)atoll(argv[++i]);
+        else if (a == "--events" && i + 1 < argc) total_events = (uint64_t)atoll(argv[++i]);
+        else if (a == "--queue" && i + 1 < argc) queue_cap = (size_t)atoll(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s stress [--endpoints n] [--threads n] [--events n] [--queue n]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (endpoints == 0 || threads == 0 || queue_cap == 0) return 1;
+
+    std::vector<std::wstring> blocked;
+    blocked.push_back(L"Blocked");
+    SimEnumerator enumerator(endpoints, 16);
+    EventQueue queue(queue_cap);
+    KeepAliveCore core(&blocked);
+    SimPlayback playback(0);
+    std::vector<DeviceEvent> batch;
+    batch.reserve(queue_cap);
+
+    std::atomic<uint64_t> fired(0);
+    std::atomic<size_t> running(threads);
+    uint64_t processed = 0, restarts = 0, resyncs = 0;
+    uint64_t rss_start = process_rss_bytes(), rss_mid = 0;
+
+    // 各线程用固定种子，相同参数下翻转序列可复现（线程间交错仍由调度决定）
+    std::vector<std::thread> workers;
+    int64_t t0 = steady_us();
+    for (size_t w = 0; w < threads; w++) {
+        workers.emplace_back([&, w]() {
+            std::mt19937_64 rng(0x6b61 + w);
+            static const uint32_t states[3] = { SIM_STATE_ACTIVE, SIM_STATE_UNPLUGGED, SIM_STATE_NOTPRESENT };
+            while (fired.fetch_add(1, std::memory_order_relaxed) < total_events) {
+                enumerator.set_state((size_t)(rng() % endpoints), states[rng() % 3], steady_us(), queue);
+                std::this_thread::yield();   // 真实回调之间有间隔，不让生产者一直占着锁
+            }
+            running.fetch_sub(1);
+        });
+    }
+
+    // 消费者：与主循环相同，取空队列、溢出则重新查询默认设备、再交给 KeepAliveCore
+    while (true) {
+        bool done = running.load() == 0;
+        batch.clear();
+        if (queue.drain(batch)) {
+            wchar_t id[DEVICE_ID_LEN], name[DEVICE_NAME_LEN];
+            enumerator.get_default(id, name);
+            batch.push_back(make_device_event(steady_us(), EV_DEFAULT_CHANGED, id, SIM_STATE_ACTIVE, name));
+            resyncs++;
+        }
+        for (const DeviceEvent& e : batch) core.apply(e);
+        processed += batch.size();
+        if (core.pending()) {
+            core.set_playing(playback.playing());
+            KeepAliveCore::Action action = core.decide();
+            restarts++;
+            if (action.stop) playback.stop();
+            if (action.start) playback.start(0);
+            core.set_playing(playback.playing());
+        }
+        if (batch.empty()) {
+            if (done) break;
+            std::this_thread::yield();
+        }
+        if (!rss_mid && fired.load(std::memory_order_relaxed) >= total_events / 2) rss_mid = process_rss_bytes();
+    }
+    int64_t t1 = steady_us();
+    for (auto& t : workers) t.join();
+    uint64_t rss_end = process_rss_bytes();
+
+    // 真实状态：枚举器当前的默认设备，非空且不在阻止列表中时应该在播放
+    wchar_t id[DEVICE_ID_LEN], name[DEVICE_NAME_LEN];
+    enumerator.get_default(id, name);
+    bool want = id[0] && !is_blocked_device(name, blocked);
+    bool default_ok = wcscmp(id, core.default_id()) == 0;
+    bool playing_ok = playback.playing() == want && core.should_play() == want;
+
+    double secs = (t1 - t0) / 1e6;
+    printf("endpoints         %zu, callback threads %zu, queue capacity %zu\n", endpoints, threads, queue_cap);
+    printf("events            %llu state flips, %llu events processed, %llu dropped, %llu resyncs\n",
+           (unsigned long long)total_events, (unsigned long long)processed,
+           (unsigned long long)queue.dropped(), (unsigned long long)resyncs);
+    printf("throughput        %.0f events/s (%.2f s)\n", secs > 0 ? processed / secs : 0.0, secs);
+    printf("queue high water  %zu of %zu\n", queue.high_water(), queue.capacity());
+    printf("restarts          %llu (starts %llu, stops %llu)\n", (unsigned long long)restarts,
+           (unsigned long long)playback.starts(), (unsigned long long)playback.stops());
+    printf("rss               start %.1f MB, mid %.1f MB, end %.1f MB\n", rss_start / 1048576.0,
+           rss_mid / 1048576.0, rss_end / 1048576.0);
+    printf("final decision    %s (default %s, playing %s, expected %s)\n", default_ok && playing_ok ? "OK" : "MISMATCH",
+           default_ok ? "matches" : "differs", playback.playing() ? "yes" : "no", want ? "yes" : "no");
+    return default_ok && playing_ok ? 0 : 2;
+}
+
+// ===== soak =====
+// 与 keepalive_log 的 write_log + 日志线程做同样的工作：时间戳 + 消息拼成定长的一行，再转成 UTF-8 进文件缓冲区。
+// 虚拟时钟换算成日历时间，不读系统时间。
+class SimLogSink {
+public:
+    SimLogSink() { file_buf_.reserve(FLUSH_BYTES + 4 * LOG_LINE_MAX); }
+
+    void write(int64_t virtual_us, const wchar_t* msg) {
+        time_t t = (time_t)(SIM_EPOCH + virtual_us / 1000000);
+        struct tm tm;
+#ifdef _WIN32
+        gmtime_s(&tm, &t);
+#else
+        gmtime_r(&t, &tm);
+#endif
+        LogTimestamp ts = { tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec };
+        wchar_t buf[LOG_TIMESTAMP_LEN + 1];
+        LogText line;
+        line.append(buf, format_log_timestamp(buf, ts)) << msg;
+        append_utf8(file_buf_, line.c_str(), line.size());
+        file_buf_ += "\r\n";
+        if (file_buf_.size() >= FLUSH_BYTES) {
+            bytes_ += file_buf_.size();
+            file_buf_.clear();
+        }
+        lines_++;
+    }
+    uint64_t lines() const { return lines_; }
+
+private:
+    static const time_t SIM_EPOCH = 1767225600;   // 2026-01-01 00:00:00 UTC
+    static const size_t FLUSH_BYTES = 64 * 1024;
+    std::string file_buf_;
+    uint64_t bytes_ = 0;
+    uint64_t lines_ = 0;
+};
+
+// 单线程的完整事件路径：模拟枚举器 → EventQueue → KeepAliveCore → 生命周期协程 → 模拟播放，
+// 每个事件和动作都写一行日志
+class SimPipeline {
+public:
+    SimPipeline(size_t endpoints, size_t blocked_every)
+        : enumerator_(endpoints, blocked_every), queue_(64), core_(&blocked_), playback_(30000), rng_(0x736f616b) {
+        blocked_.push_back(L"Blocked");
+        batch_.reserve(queue_.capacity());
+    }
+
+    // 推进虚拟时间（平均 5 秒）并随机改变一个 endpoint 的状态，返回产生的事件数
+    size_t step(SimClock& clock) {
+        static const uint32_t states[3] = { SIM_STATE_ACTIVE, SIM_STATE_UNPLUGGED, SIM_STATE_NOTPRESENT };
+        clock.advance_to(clock.now_us() + (int64_t)(rng_() % 10000000));
+        int64_t now = clock.now_us();
+        enumerator_.set_state((size_t)(rng_() % enumerator_.size()), states[rng_() % 3], now, queue_);
+
+        batch_.clear();
+        queue_.drain(batch_);
+        for (const DeviceEvent& e : batch_) {
+            if (e.type == EV_DEFAULT_CHANGED) log_.write(now, (LogText(L"Device changed -> ") << e.name).c_str());
+            else log_.write(now, L"Audio device state changed.");
+            core_.apply(e);
+        }
+        if (!batch_.empty()) exec_.notify(device_signal_);
+        if (core_.pending()) {
+            exec_.cancel(lifecycle_cancel_);
+            exec_.spawn(lifecycle(CancelToken(lifecycle_cancel_)));
+        }
+        exec_.run(now / 1000);
+        return batch_.size();
+    }
+
+    uint64_t log_lines() const { return log_.lines(); }
+
+private:
+    // 与 keepalive_log 的 playback_lifecycle 相同的步骤：还要播放时不先停，新流开起来才算换过去
+    // （SimPlayback::start 直接替换旧流）；开流失败按 FailureStreaks + Backoff 重试，放弃时才停掉旧流。
+    // 模拟开流每 8 次失败 1 次
+    Task<> lifecycle(CancelToken tok) {
+        KeepAliveCore::Action action = core_.decide();
+        wchar_t id[DEVICE_ID_LEN] = {};
+        if (action.stop) core_.set_playing(false);
+        if (!action.start) {
+            if (playback_.playing()) {
+                playback_.stop();
+                log_.write(exec_.now() * 1000, L"Playback stopped.");
+            }
+        } else {
+            copy_wfield(id, DEVICE_ID_LEN, core_.default_id());
+            bool ready = co_await wait_until(exec_, device_signal_, [this, &id] {
+                return core_.default_active() && wcscmp(core_.default_id(), id) == 0;
+            }, 2000, tok);
+            while (ready) {
+                if (rng_() % 8 != 0) {
+                    playback_.start(exec_.now() * 1000);
+                    core_.set_playing(true);
+                    streaks_.succeed(id);
+                    log_.write(exec_.now() * 1000, L"Playback started.");
+                    break;
+                }
+                uint32_t streak = streaks_.fail(id, exec_.now());
+                int64_t delay = backoff_.delay(streak - 1);
+                log_.write(exec_.now() * 1000, (LogText(L"Start failed ") << (uint64_t)streak << L" time(s) in a row, retrying in " <<
+                                                (uint64_t)delay << L" ms.").c_str());
+                ready = co_await exec_.sleep(delay, tok);
+            }
+            if (!ready && !tok.cancelled()) {
+                if (playback_.playing()) playback_.stop();   // 旧设备上的流
+                core_.set_playing(false);
+                log_.write(exec_.now() * 1000, (LogText(L"Device not ready, playback not started: ") << id).c_str());
+            }
+        }
+    }
+
+    std::vector<std::wstring> blocked_;
+    SimEnumerator enumerator_;
+    EventQueue queue_;
+    KeepAliveCore core_;
+    SimPlayback playback_;
+    SimLogSink log_;
+    std::vector<DeviceEvent> batch_;
+    std::mt19937_64 rng_;
+    Executor exec_;
+    Signal device_signal_;
+    CancelSource lifecycle_cancel_;
+    Backoff backoff_;
+    FailureStreaks streaks_;
+};
+
+struct SoakSample {
+    uint64_t events;
+    int64_t live_bytes;
+    int64_t live_blocks;
+    uint64_t handles;
+    double allocs_per_event;   // 自上一个采样点以来
+};
+
+// 去掉前 1/5 预热，对剩下的采样做最小二乘直线拟合；拟合出的增量超过起点的 10% 加 slack 视为无界增长
+template <typename F>
+static bool grew(const std::vector<SoakSample>& v, F value, double slack) {
+    size_t begin = v.size() / 5;
+    double n = (double)(v.size() - begin), sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (size_t i = begin; i < v.size(); i++) {
+        double x = (double)(i - begin), y = value(v[i]);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    double var = n * sxx - sx * sx;
+    if (n < 2 || var <= 0) return false;
+    double slope = (n * sxy - sx * sy) / var;
+    double start = (sy - slope * sx) / n;
+    return slope * (n - 1) > (start > 0 ? start : 0) * 0.1 + slack;
+}
+
+static int run_soak(int argc, char** argv) {
+    uint64_t transitions = 5000000;
+    size_t endpoints = 8, samples = 50;
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--transitions" && i + 1 < argc) transitions = (uint64_t)atoll(argv[++i]);
+        else if (a == "--endpoints" && i + 1 < argc) endpoints = (size_t)atoll(argv[++i]);
+        else if (a == "--samples" && i + 1 < argc) samples = (size_t)atoll(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s soak [--transitions n] [--endpoints n] [--samples n]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (endpoints == 0 || samples < 10 || transitions < samples) return 1;
+
+    SimPipeline pipeline(endpoints, 4);
+    SimClock clock(0);
+    std::vector<SoakSample> series;
+    series.reserve(samples);
+
+    uint64_t events = 0, sample_events = 0;
+    uint64_t sample_allocs = g_alloc_count.load();
+    uint64_t every = transitions / samples;
+    auto wall0 = std::chrono::steady_clock::now();
+
+    for (uint64_t n = 1; n <= transitions; n++) {
+        size_t produced = pipeline.step(clock);
+        events += produced;
+        sample_events += produced;
+
+        if (n % every == 0) {
+            uint64_t allocs = g_alloc_count.load();
+            SoakSample s = { events, g_alloc_live_bytes.load(), g_alloc_live_blocks.load(), process_handle_count(),
+                             sample_events ? (double)(allocs - sample_allocs) / sample_events : 0.0 };
+            series.push_back(s);
+            sample_allocs = g_alloc_count.load();
+            sample_events = 0;
+        }
+    }
+    double wall_s = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - wall0).count() / 1000.0;
+
+    bool bytes_grew = grew(series, [](const SoakSample& x) { return (double)x.live_bytes; }, 4096);
+    bool blocks_grew = grew(series, [](const SoakSample& x) { return (double)x.live_blocks; }, 16);
+    bool handles_grew = grew(series, [](const SoakSample& x) { return (double)x.handles; }, 4);
+    bool allocs_grew = grew(series, [](const SoakSample& x) { return x.allocs_per_event; }, 0.5);
+
+    printf("%12s %14s %12s %8s %14s\n", "events", "live_bytes", "live_blocks", "handles", "allocs/event");
+    size_t step = series.size() / 10 ? series.size() / 10 : 1;
+    for (size_t i = 0; i < series.size(); i += step)
+        printf("%12llu %14lld %12lld %8llu %14.2f\n", (unsigned long long)series[i].events,
+               (long long)series[i].live_bytes, (long long)series[i].live_blocks,
+               (unsigned long long)series[i].handles, series[i].allocs_per_event);
+    printf("transitions       %llu over %.1f virtual days, %llu events, %llu log lines, %.2f s wall\n",
+           (unsigned long long)transitions, clock.now_us() / 86400e6, (unsigned long long)events,
+           (unsigned long long)pipeline.log_lines(), wall_s);
+    printf("growth            live bytes %s, live blocks %s, handles %s, allocs/event %s\n",
+           bytes_grew ? "GROWING" : "flat", blocks_grew ? "GROWING" : "flat",
+           handles_grew ? "GROWING" : "flat", allocs_grew ? "GROWING" : "flat");
+    return bytes_grew || blocks_grew || handles_grew || allocs_grew ? 2 : 0;
+}
+
+// ===== allocs =====
+static int run_allocs(int argc, char** argv) {
+    uint64_t warmup = 10000, target = 100000;
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--warmup" && i + 1 < argc) warmup = (uint64_t)atoll(argv[++i]);
+        else if (a == "--events" && i + 1 < argc) target = (uint64_t)atoll(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s allocs [--warmup n] [--events n]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    SimPipeline pipeline(8, 4);
+    SimClock clock(0);
+    for (uint64_t events = 0; events < warmup;) events += pipeline.step(clock);
+
+    uint64_t before = g_alloc_count.load();
+    uint64_t events = 0, transitions = 0;
+    while (events < target) {
+        events += pipeline.step(clock);
+        transitions++;
+    }
+    uint64_t allocs = g_alloc_count.load() - before;
+
+    printf("after %llu warm-up events: %llu events (%llu transitions, %llu log lines) -> %llu allocations\n",
+           (unsigned long long)warmup, (unsigned long long)events, (unsigned long long)transitions,
+           (unsigned long long)pipeline.log_lines(), (unsigned long long)allocs);
+    if (allocs != 0) {
+        printf("FAIL: steady-state event path allocates\n");
+        return 2;
+    }
+    return 0;
+}
+
+// ===== lifecycle =====
+// 一个模拟 endpoint：驱动协程改状态并通知 changed，生命周期协程据此开始/停止播放。
+// engine_ready_ms 之前开始播放会失败，模拟蓝牙刚连上时 PlaySound 失败的情况。
+struct SimDevice {
+    bool connected = false;
+    bool active = false;
+    bool playing = false;
+    bool retrying = false;
+    int64_t active_since_ms = 0;
+    int64_t engine_ready_ms = 0;
+    uint32_t streak = 0;   // 连续启动失败次数
+    Signal changed;
+};
+
+struct LifecycleStats {
+    uint64_t connects = 0;
+    uint64_t starts = 0;
+    uint64_t stops = 0;
+    uint64_t ready_timeouts = 0;
+    uint64_t start_failures = 0;
+    uint64_t abandoned_retries = 0;   // 重试期间设备断开
+    LatencyHistogram recover_ms;      // 变为活动到开始播放
+};
+
+// 断开一段时间 → 连上 → 过一段就绪时间才变为活动（偶尔比超时还长）→ 在线一段时间 → 断开
+static Task<> drive_device(Executor& ex, SimDevice& d, std::mt19937_64& rng, LifecycleStats& st, CancelToken tok) {
+    while (true) {
+        bool ok = co_await ex.sleep(60000 + (int64_t)(rng() % 3600000), tok);
+        if (!ok) break;
+        d.connected = true;
+        st.connects++;
+        ex.notify(d.changed);
+        ok = co_await ex.sleep(rng() % 8 ? (int64_t)(rng() % 1500) : 2000 + (int64_t)(rng() % 3000), tok);
+        if (!ok) break;
+        // 一半的连接引擎要再过几百毫秒才能播放，少数要一分钟以上
+        uint64_t r = rng() % 64;
+        d.engine_ready_ms = ex.now() + (r == 0 ? 60000 + (int64_t)(rng() % 120000) : r < 32 ? (int64_t)(rng() % 400) : 0);
+        d.active = true;
+        d.active_since_ms = ex.now();
+        ex.notify(d.changed);
+        ok = co_await ex.sleep(60000 + (int64_t)(rng() % 7200000), tok);
+        if (!ok) break;
+        d.active = d.connected = false;
+        ex.notify(d.changed);
+    }
+}
+
+// 启动失败后等退避间隔再试；期间设备状态变化会提前唤醒，设备不再活动就放弃
+static Task<bool> start_with_retry(Executor& ex, SimDevice& d, Backoff& backoff, LifecycleStats& st, CancelToken tok) {
+    while (d.active && !tok.cancelled()) {
+        if (ex.now() >= d.engine_ready_ms) {
+            d.streak = 0;
+            co_return true;
+        }
+        st.start_failures++;
+        d.retrying = true;
+        int64_t deadline = ex.now() + backoff.delay(d.streak++);
+        while (d.active && ex.now() < deadline) {
+            WakeReason r = co_await ex.wait(d.changed, deadline, tok);
+            if (r == WAKE_CANCELLED) break;
+        }
+        d.retrying = false;
+    }
+    if (!tok.cancelled()) st.abandoned_retries++;
+    co_return false;
+}
+
+static Task<> device_lifecycle(Executor& ex, SimDevice& d, Backoff& backoff, int64_t ready_timeout_ms,
+                               LifecycleStats& st, CancelToken tok) {
+    while (!tok.cancelled()) {
+        bool ok = co_await wait_until(ex, d.changed, [&d] { return d.connected; }, TASK_NO_DEADLINE, tok);
+        if (!ok) break;
+        ok = co_await wait_until(ex, d.changed, [&d] { return d.active || !d.connected; }, ready_timeout_ms, tok);
+        if (!ok) {
+            if (tok.cancelled()) break;
+            st.ready_timeouts++;   // 真实程序会记一条日志，然后等设备自己变为活动
+            ok = co_await wait_until(ex, d.changed, [&d] { return d.active || !d.connected; }, TASK_NO_DEADLINE, tok);
+            if (!ok) break;
+        }
+        if (!d.active) continue;
+        ok = co_await start_with_retry(ex, d, backoff, st, tok);
+        if (!ok) continue;
+        d.playing = true;
+        st.starts++;
+        st.recover_ms.record(ex.now() - d.active_since_ms);
+        ok = co_await wait_until(ex, d.changed, [&d] { return !d.active; }, TASK_NO_DEADLINE, tok);
+        if (!ok) break;
+        d.playing = false;
+        st.stops++;
+    }
+    d.playing = false;
+}
+
+static int run_lifecycle(int argc, char** argv) {
+    size_t devices = 10000;
+    double hours = 24;
+    int64_t ready_timeout_ms = 2000;
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--devices" && i + 1 < argc) devices = (size_t)atoll(argv[++i]);
+        else if (a == "--hours" && i + 1 < argc) hours = atof(argv[++i]);
+        else if (a == "--ready-timeout-ms" && i + 1 < argc) ready_timeout_ms = atoll(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s lifecycle [--devices n] [--hours h] [--ready-timeout-ms ms]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (devices == 0) return 1;
+
+    Executor ex;
+    std::vector<SimDevice> devs(devices);
+    std::mt19937_64 rng(0x6c696665);
+    LifecycleStats st;
+    Backoff backoff(Backoff::Config(), 0x72657472);
+    CancelSource shutdown;
+    for (size_t i = 0; i < devices; i++) {
+        ex.spawn(device_lifecycle(ex, devs[i], backoff, ready_timeout_ms, st, CancelToken(shutdown)));
+        ex.spawn(drive_device(ex, devs[i], rng, st, CancelToken(shutdown)));
+    }
+    int spawned = ex.live();
+
+    // 每推进一次就检查一遍：设备状态变化后的同一次 run() 里生命周期协程必须已经跟上
+    int64_t end_ms = (int64_t)(hours * 3600000);
+    uint64_t steps = 0, mismatches = 0, warm_allocs = 0;
+    size_t peak_timers = 0;
+    auto wall0 = std::chrono::steady_clock::now();
+    ex.run(0);
+    while (ex.next_deadline() <= end_ms) {
+        ex.run(ex.next_deadline());
+        if (++steps == 1000) warm_allocs = g_alloc_count.load();
+        if (ex.timers() > peak_timers) peak_timers = ex.timers();
+        if (steps % 4096 == 0 || ex.next_deadline() > end_ms)
+            for (const SimDevice& d : devs)
+                if (d.playing ? !d.active : d.active && !d.retrying) mismatches++;
+    }
+    uint64_t allocs = steps > 1000 ? g_alloc_count.load() - warm_allocs : 0;
+    uint64_t resumes = ex.resumes();
+    double wall_s = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - wall0).count() / 1000.0;
+
+    ex.cancel(shutdown);
+    ex.run(end_ms);
+    bool drained = ex.live() == 0 && ex.timers() == 0;
+
+    printf("devices           %zu (%d coroutines on one thread), %.1f virtual hours\n", devices, spawned, hours);
+    printf("lifecycle         %llu connects, %llu starts, %llu stops, %llu ready timeouts (> %lld ms)\n",
+           (unsigned long long)st.connects, (unsigned long long)st.starts, (unsigned long long)st.stops,
+           (unsigned long long)st.ready_timeouts, (long long)ready_timeout_ms);
+    LatencyHistogram::Snapshot snap;
+    st.recover_ms.snapshot(snap);
+    printf("start retries     %llu failed starts, %llu retries abandoned on disconnect\n",
+           (unsigned long long)st.start_failures, (unsigned long long)st.abandoned_retries);
+    printf("active->playing   p50 %llu ms, p90 %llu ms, p99 %llu ms, max %llu ms\n",
+           (unsigned long long)snap.percentile(50), (unsigned long long)snap.percentile(90),
+           (unsigned long long)snap.percentile(99), (unsigned long long)snap.max());
+    printf("executor          %llu steps, %llu resumes (%.0f /s wall, %.2f s), peak timers %zu\n",
+           (unsigned long long)steps, (unsigned long long)resumes, wall_s > 0 ? resumes / wall_s : 0.0, wall_s,
+           peak_timers);
+    printf("allocations       %llu after warm-up\n", (unsigned long long)allocs);
+    printf("invariants        playing==active (or retrying) %s (%llu mismatches), shutdown %s (%d live, %zu timers)\n",
+           mismatches ? "FAIL" : "OK", (unsigned long long)mismatches, drained ? "OK" : "FAIL", ex.live(),
+           ex.timers());
+    return mismatches || !drained ? 2 : 0;
+}
+
+// ===== dutycycle =====
+// 模拟接收端：记下流最后一次关闭的时间，开流时检查静默是否超过空闲超时
+struct SimSink {
+    DutyCyclePlan plan;
+    DutyCycleMeter meter;
+    int64_t closed_ms = -1;
+    int64_t max_silence_ms = 0;
+    uint64_t opens = 0;
+    uint64_t slept = 0;    // 静默超过空闲超时，接收端已经休眠
+};
+
+// 与 keepalive_log 的 duty_cycle() 同样的循环，开关流换成模拟接收端
+static Task<> sim_duty_cycle(Executor& ex, SimSink& sink, CancelToken tok) {
+    sink.meter.set_active(true, ex.now());
+    sink.opens++;
+    if (!sink.plan.enabled()) co_return;   // 持续播放
+    BurstSchedule sched(sink.plan);
+    sched.opened(ex.now());
+    while (true) {
+        bool ok = co_await ex.sleep(sched.next_ms() - ex.now(), tok);
+        if (!ok) break;
+        if (sched.open()) {
+            sink.meter.set_active(false, ex.now());
+            sink.closed_ms = ex.now();
+            sched.closed(ex.now());
+            continue;
+        }
+        int64_t silence = ex.now() - sink.closed_ms;
+        if (silence > sink.max_silence_ms) sink.max_silence_ms = silence;
+        if (silence > sink.plan.idle_timeout_ms) sink.slept++;
+        sink.meter.set_active(true, ex.now());
+        sink.opens++;
+        sched.opened(ex.now());
+    }
+}
+
+static int run_dutycycle(int argc, char** argv) {
+    size_t devices = 1000;
+    double hours = 24;
+    int64_t late_ms = 50;
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--devices" && i + 1 < argc) devices = (size_t)atoll(argv[++i]);
+        else if (a == "--hours" && i + 1 < argc) hours = atof(argv[++i]);
+        else if (a == "--late-ms" && i + 1 < argc) late_ms = atoll(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s dutycycle [--devices n] [--hours h] [--late-ms ms]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (devices == 0 || late_ms < 0) return 1;
+
+    // 配置行：格式不对的必须被拒绝
+    static const char* const BAD_LINES[] = { "NoTimeout", "=30", "Dev=0", "Dev=-5", "Dev=30,", "Dev=30,0", "Dev=x", "Dev=30 junk", "Dev=autox" };
+    uint64_t bad_accepted = 0;
+    for (const char* line : BAD_LINES) {
+        DutyCycleDevice d;
+        if (parse_duty_cycle_device(line, d)) bad_accepted++;
+    }
+    static const int64_t TIMEOUTS_S[] = { 3, 10, 15, 20, 30, 45, 60 };
+    static const int64_t BURSTS_MS[] = { 0, 250, 500, 1000, 2000 };
+    std::mt19937_64 rng(0x64757479);
+    std::vector<SimSink> sinks(devices);
+    std::vector<DutyCycleDevice> list;
+    uint64_t continuous = 0;
+    for (size_t i = 0; i < devices; i++) {
+        int64_t timeout_s = TIMEOUTS_S[rng() % (sizeof(TIMEOUTS_S) / sizeof(TIMEOUTS_S[0]))];
+        int64_t burst_ms = BURSTS_MS[rng() % (sizeof(BURSTS_MS) / sizeof(BURSTS_MS[0]))];
+        char line[64];
+        if (burst_ms) snprintf(line, sizeof(line), "Sink %06zu = %lld, %lld", i, (long long)timeout_s, (long long)burst_ms);
+        else snprintf(line, sizeof(line), "Sink %06zu=%lld", i, (long long)timeout_s);
+        DutyCycleDevice d;
+        if (!parse_duty_cycle_device(line, d)) {
+            fprintf(stderr, "config line rejected: %s\n", line);
+            return 2;
+        }
+        list.push_back(d);
+    }
+    // 按设备名查配置，与 keepalive_log 查默认设备的方式相同：完整名字里带着配置的子串
+    Executor ex;
+    CancelSource shutdown;
+    uint64_t lookup_misses = 0;
+    for (size_t i = 0; i < devices; i++) {
+        wchar_t name[64];
+        swprintf(name, 64, L"Headphones (Sink %06zu)", i);
+        const DutyCycleDevice* d = find_duty_cycle_device(name, list);
+        if (d != &list[i]) {
+            lookup_misses++;
+            continue;
+        }
+        sinks[i].plan = plan_duty_cycle(d->idle_timeout_ms, d->burst_ms);
+        if (!sinks[i].plan.enabled()) continuous++;
+        ex.spawn(sim_duty_cycle(ex, sinks[i], CancelToken(shutdown)));
+    }
+
+    int64_t end_ms = (int64_t)(hours * 3600000);
+    uint64_t steps = 0;
+    auto wall0 = std::chrono::steady_clock::now();
+    ex.run(0);
+    while (ex.next_deadline() <= end_ms) {
+        ex.run(ex.next_deadline() + (late_ms ? (int64_t)(rng() % (uint64_t)(late_ms + 1)) : 0));
+        steps++;
+    }
+    double wall_s = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - wall0).count() / 1000.0;
+    int64_t now = ex.now() > end_ms ? ex.now() : end_ms;
+
+    // 计划占空比 burst / (burst + gap)；晚醒让 burst 和 gap 都可能变长，允许 late_ms 量级的偏差
+    uint64_t slept = 0, bursts = 0, off_plan = 0, bad_fallback = 0;
+    int64_t worst_overrun = INT64_MIN;
+    double duty_sum = 0, duty_min = 1, duty_max = 0;
+    for (const SimSink& k : sinks) {
+        if (!k.opens) continue;
+        slept += k.slept;
+        bursts += k.opens;
+        double ratio = k.meter.ratio(now);
+        duty_sum += ratio;
+        if (ratio < duty_min) duty_min = ratio;
+        if (ratio > duty_max) duty_max = ratio;
+        if (!k.plan.enabled()) {
+            if (ratio < 0.999) bad_fallback++;
+            continue;
+        }
+        double expect = (double)k.plan.burst_ms / (double)(k.plan.burst_ms + k.plan.gap_ms);
+        double slack = (double)(late_ms + 1) / (double)(k.plan.burst_ms + k.plan.gap_ms) + 0.002;
+        if (ratio < expect - slack || ratio > expect + slack) off_plan++;
+        // 最长静默不超过 gap + 一次晚醒：下一次开流从关流时刻算，误差不累积
+        int64_t overrun = k.max_silence_ms - k.plan.gap_ms;
+        if (overrun > worst_overrun) worst_overrun = overrun;
+    }
+    bool drift_ok = worst_overrun <= late_ms;
+    size_t scheduled = devices - (size_t)lookup_misses;
+
+    ex.cancel(shutdown);
+    ex.run(now);
+    bool drained = ex.live() == 0 && ex.timers() == 0;
+
+    printf("devices           %zu (%llu continuous: idle timeout too short), %.1f virtual hours, wake-ups up to %lld ms late\n",
+           scheduled, (unsigned long long)continuous, hours, (long long)late_ms);
+    printf("bursts            %llu opens, %llu steps, %.2f s wall\n", (unsigned long long)bursts,
+           (unsigned long long)steps, wall_s);
+    printf("duty cycle        mean %.2f%%, min %.2f%%, max %.2f%%\n", scheduled ? duty_sum / scheduled * 100 : 0.0,
+           duty_min * 100, duty_max * 100);
+    printf("silence           worst overrun past planned gap %lld ms\n", worst_overrun == INT64_MIN ? 0ll : (long long)worst_overrun);
+    printf("invariants        sink never idle %s (%llu), duty cycle as planned %s (%llu off), no drift %s, "
+           "fallback %s (%llu), config %s (%llu bad lines accepted, %llu lookups missed), shutdown %s (%d live, %zu timers)\n",
+           slept ? "FAIL" : "OK", (unsigned long long)slept, off_plan ? "FAIL" : "OK", (unsigned long long)off_plan,
+           drift_ok ? "OK" : "FAIL", bad_fallback ? "FAIL" : "OK", (unsigned long long)bad_fallback,
+           bad_accepted || lookup_misses ? "FAIL" : "OK", (unsigned long long)bad_accepted,
+           (unsigned long long)lookup_misses, drained ? "OK" : "FAIL", ex.live(), ex.timers());
+    return slept || off_plan || !drift_ok || bad_fallback || bad_accepted || lookup_misses || !drained ? 2 : 0;
+}
+
+// ===== learn =====
+struct LearnDevice {
+    int64_t hidden_ms = 0;   // 真实空闲超时，0 表示不会休眠
+    int64_t detect_ms = 0;   // 休眠后多久系统发出设备移除
+    int64_t next_user_drop_ms = 0;
+    int64_t converged_ms = -1;
+    uint64_t timeout_drops = 0;
+    uint64_t late_drops = 0;   // 按收敛后的计划静默仍因超时断开
+    uint64_t user_drops = 0;
+    IdleTimeoutLearner learner;
+};
+
+static const int64_t LEARN_USER_DROP_MEAN_MS = 12 * 3600000ll;
+
+static int64_t next_user_drop(std::mt19937_64& rng, int64_t now) {
+    return now + (int64_t)(std::exponential_distribution<double>(1.0 / LEARN_USER_DROP_MEAN_MS)(rng));
+}
+
+// 一个设备：连着时按学习计划开关流，断开后过 10~60 s 再连上。被取消时设备还在，与 keepalive_log 退出时相同
+static Task<> learn_device(Executor& ex, LearnDevice& d, std::mt19937_64& rng, CancelToken tok) {
+    while (true) {
+        DutyCyclePlan plan = d.learner.plan();
+        BurstSchedule sched(plan);
+        sched.opened(ex.now());
+        int64_t drop_at = INT64_MAX;   // 接收端休眠后系统发现断开的时刻
+        bool drop_converged = false;   // 让接收端休眠的那段静默是不是按收敛后的计划排的
+        int64_t closed_ms = 0;
+        bool user_drop = false;
+        while (true) {
+            int64_t next = plan.enabled() ? sched.next_ms() : INT64_MAX;
+            if (drop_at < next) next = drop_at;
+            if (d.next_user_drop_ms < next) next = d.next_user_drop_ms;
+            bool ok = co_await ex.sleep(next - ex.now(), tok);
+            if (!ok) {
+                d.learner.gap_ended(ex.now());
+                co_return;
+            }
+            if (ex.now() >= drop_at || ex.now() >= d.next_user_drop_ms) {
+                user_drop = ex.now() < drop_at;
+                break;
+            }
+            if (ex.now() < sched.next_ms()) continue;
+            if (sched.open()) {
+                d.learner.gap_started(ex.now());
+                DutyCyclePlan p = d.learner.plan();
+                if (p.enabled()) sched.set_plan(p);
+                sched.closed(ex.now());
+                closed_ms = ex.now();
+                if (d.hidden_ms && drop_at == INT64_MAX) {   // 已经休眠的不会推迟
+                    drop_at = closed_ms + d.hidden_ms + d.detect_ms;
+                    drop_converged = d.learner.converged();
+                }
+            } else {
+                if (d.hidden_ms && ex.now() < closed_ms + d.hidden_ms) drop_at = INT64_MAX;   // 休眠前收到了音频
+                sched.opened(ex.now());
+                d.learner.gap_ended(ex.now());
+            }
+            if (d.converged_ms < 0 && d.learner.converged()) d.converged_ms = ex.now();
+        }
+        d.learner.device_lost(ex.now());
+        if (user_drop) {
+            d.user_drops++;
+            d.next_user_drop_ms = next_user_drop(rng, ex.now());
+        } else {
+            d.timeout_drops++;
+            if (drop_converged) d.late_drops++;
+        }
+        if (d.converged_ms < 0 && d.learner.converged()) d.converged_ms = ex.now();
+        bool ok = co_await ex.sleep(10000 + (int64_t)(rng() % 50000), tok);
+        if (!ok) co_return;
+    }
+}
+
+static bool same_record(const IdleTimeoutRecord& a, const IdleTimeoutRecord& b) {
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static int run_learn(int argc, char** argv) {
+    size_t devices = 1000;
+    double hours = 24, restart_hours = 6;
+    int64_t late_ms = 50;
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--devices" && i + 1 < argc) devices = (size_t)atoll(argv[++i]);
+        else if (a == "--hours" && i + 1 < argc) hours = atof(argv[++i]);
+        else if (a == "--restart-hours" && i + 1 < argc) restart_hours = atof(argv[++i]);
+        else if (a == "--late-ms" && i + 1 < argc) late_ms = atoll(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s learn [--devices n] [--hours h] [--restart-hours h] [--late-ms ms]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (devices == 0 || late_ms < 0 || restart_hours <= 0) return 1;
+
+    std::mt19937_64 rng(0x6c6561726e);
+    std::vector<LearnDevice> devs(devices);
+    for (LearnDevice& d : devs) {
+        uint64_t r = rng() % 10;
+        d.hidden_ms = r == 0 ? 0 : r == 1 ? 3000 + (int64_t)(rng() % 7000) : r == 2 ? 60000 + (int64_t)(rng() % 240000)
+                    : 10000 + (int64_t)(rng() % 50000);
+        d.detect_ms = (int64_t)(rng() % 2000);
+        d.next_user_drop_ms = next_user_drop(rng, 0);
+    }
+
+    int64_t end_ms = (int64_t)(hours * 3600000);
+    int64_t epoch_ms = (int64_t)(restart_hours * 3600000);
+    Executor ex;
+    uint64_t steps = 0, restarts = 0, persist_mismatches = 0;
+    auto wall0 = std::chrono::steady_clock::now();
+    for (int64_t epoch_end = epoch_ms; ; epoch_end += epoch_ms) {
+        if (epoch_end > end_ms) epoch_end = end_ms;
+        CancelSource process;
+        for (LearnDevice& d : devs) ex.spawn(learn_device(ex, d, rng, CancelToken(process)));
+        ex.run(ex.now());
+        while (ex.next_deadline() <= epoch_end) {
+            ex.run(ex.next_deadline() + (late_ms ? (int64_t)(rng() % (uint64_t)(late_ms + 1)) : 0));
+            steps++;
+        }
+        ex.cancel(process);
+        ex.run(ex.now());
+        if (ex.live() != 0) break;
+        if (epoch_end >= end_ms) break;
+
+        // 进程重启：按文件格式写出，再读进新的学习器，重新保存必须逐字节相同
+        std::string file;
+        for (LearnDevice& d : devs) {
+            IdleTimeoutRecord r = {};
+            d.learner.save(r);
+            snprintf(r.endpoint_id, sizeof(r.endpoint_id), "{0.0.0.00000000}.{sim-%zu}", (size_t)(&d - &devs[0]));
+            file.append((const char*)&r, sizeof(r));
+        }
+        for (size_t i = 0; i < devices; i++) {
+            IdleTimeoutRecord r, again = {};
+            memcpy(&r, file.data() + i * sizeof(r), sizeof(r));
+            IdleTimeoutLearner fresh;
+            if (!fresh.load(r)) {
+                persist_mismatches++;
+                continue;
+            }
+            fresh.save(again);
+            memcpy(again.endpoint_id, r.endpoint_id, sizeof(r.endpoint_id));
+            if (!same_record(r, again)) persist_mismatches++;
+            devs[i].learner = fresh;
+        }
+        restarts++;
+    }
+    double wall_s = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - wall0).count() / 1000.0;
+    bool drained = ex.live() == 0 && ex.timers() == 0;
+
+    uint64_t converged = 0, unsafe = 0, late_drops = 0, timeout_drops = 0, user_drops = 0, never_sleep = 0;
+    uint64_t max_drops = 0;
+    double sparse_sum = 0, sparse_min = 1e9;
+    uint64_t sparse_n = 0;
+    LatencyHistogram converge_s;
+    for (const LearnDevice& d : devs) {
+        timeout_drops += d.timeout_drops;
+        late_drops += d.late_drops;
+        user_drops += d.user_drops;
+        if (d.timeout_drops > max_drops) max_drops = d.timeout_drops;
+        if (!d.learner.converged()) continue;
+        converged++;
+        converge_s.record(d.converged_ms / 1000);
+        DutyCyclePlan p = d.learner.plan();
+        if (!d.hidden_ms) {
+            never_sleep++;
+            continue;
+        }
+        // 最长静默是计划 gap 加一次晚醒
+        if (p.enabled() && p.gap_ms + late_ms >= d.hidden_ms) unsafe++;
+        if (p.enabled()) {
+            double r = (double)p.gap_ms / (double)d.hidden_ms;
+            sparse_sum += r;
+            sparse_n++;
+            if (r < sparse_min) sparse_min = r;
+        }
+    }
+    double sparse_mean = sparse_n ? sparse_sum / sparse_n : 0;
+    bool all_converged = converged == devices;
+
+    LatencyHistogram::Snapshot snap;
+    converge_s.snapshot(snap);
+    printf("devices           %zu (%llu never sleep), %.1f virtual hours, %llu process restarts, wake-ups up to %lld ms late\n",
+           devices, (unsigned long long)never_sleep, hours, (unsigned long long)restarts, (long long)late_ms);
+    printf("converged         %llu / %zu, time to converge p50 %llu s, p90 %llu s, max %llu s\n",
+           (unsigned long long)converged, devices, (unsigned long long)snap.percentile(50),
+           (unsigned long long)snap.percentile(90), (unsigned long long)snap.max());
+    printf("drops             %llu while learning (max %llu per device), %llu after converging, %llu by the user\n",
+           (unsigned long long)(timeout_drops - late_drops), (unsigned long long)max_drops,
+           (unsigned long long)late_drops, (unsigned long long)user_drops);
+    printf("learned gap       mean %.0f%%, min %.0f%% of the hidden timeout (%llu devices bursting)\n",
+           sparse_mean * 100, sparse_n ? sparse_min * 100 : 0.0, (unsigned long long)sparse_n);
+    printf("executor          %llu steps, %.2f s wall\n", (unsigned long long)steps, wall_s);
+    printf("invariants        all converged %s, learned gap below timeout %s (%llu unsafe), no drops after converging %s, "
+           "sparse %s, persisted %s (%llu mismatches), shutdown %s (%d live, %zu timers)\n",
+           all_converged ? "OK" : "FAIL", unsafe ? "FAIL" : "OK", (unsigned long long)unsafe, late_drops ? "FAIL" : "OK",
+           sparse_mean >= 0.6 ? "OK" : "FAIL", persist_mismatches ? "FAIL" : "OK", (unsigned long long)persist_mismatches,
+           drained ? "OK" : "FAIL", ex.live(), ex.timers());
+    return !all_converged || unsafe || late_drops || sparse_mean < 0.6 || persist_mismatches || !drained ? 2 : 0;
+}
+
+// ===== otheraudio =====
+enum OtherSegKind {
+    OS_TRACK = 0,   // 响亮的音乐，开头一段轻声前奏
+    OS_GAP,         // 歌与歌之间：流还开着，没有声音
+    OS_IDLE,        // 用户暂停或什么都没放：没有流
+    OS_BEEP         // 空闲中的提示音：流只开一小会儿
+};
+
+struct OtherSeg {
+    int64_t start_ms;
+    int64_t end_ms;
+    OtherSegKind kind;
+    int64_t intro_ms;   // OS_TRACK 的轻声前奏长度
+    float level;
+};
+
+static void other_audio_timeline(std::mt19937_64& rng, int64_t end_ms, std::vector<OtherSeg>& out) {
+    int64_t t = 0;
+    auto push = [&](int64_t len, OtherSegKind kind, int64_t intro, float level) {
+        out.push_back(OtherSeg{ t, t + len, kind, intro, level });
+        t += len;
+    };
+    while (t < end_ms) {
+        // 空闲一段，中间可能响几次提示音
+        int64_t idle = rng() % 4 == 0 ? 5000 + (int64_t)(rng() % 55000) : 60000 + (int64_t)(rng() % 1140000);
+        for (int64_t left = idle; left > 0;) {
+            int64_t part = 3000 + (int64_t)(rng() % 120000);
+            if (part > left) part = left;
+            push(part, OS_IDLE, 0, 0.0f);
+            left -= part;
+            if (left > 2000 && rng() % 3 == 0) {
+                push(200 + (int64_t)(rng() % 600), OS_BEEP, 0, 0.2f + (float)(rng() % 60) / 100.0f);
+                left -= out.back().end_ms - out.back().start_ms;
+            }
+        }
+        // 一个播放列表：若干首歌，歌间静音，最后留一小段尾巴
+        int tracks = 1 + (int)(rng() % 12);
+        for (int i = 0; i < tracks; i++) {
+            push(120000 + (int64_t)(rng() % 240000), OS_TRACK, (int64_t)(rng() % 3000), 0.05f + (float)(rng() % 75) / 100.0f);
+            push(i + 1 < tracks ? 1000 + (int64_t)(rng() % 2000) : (int64_t)(rng() % 2000), OS_GAP, 0, 0.0f);
+        }
+    }
+}
+
+struct OtherAudioResult {
+    int64_t max_idle_ms = 0;
+    int64_t loud_ms = 0;
+    int64_t loud_paused_ms = 0;
+    uint64_t pauses = 0;
+    uint64_t resumes = 0;
+    uint64_t false_resumes = 0;   // 歌曲中途恢复
+    uint64_t beep_pauses = 0;     // 提示音触发的暂停
+    uint64_t switches = 0;        // 暂停中切换默认设备
+    uint64_t stale_flags = 0;     // 状态标志（keepalive_log 的 g_other_audio_paused）与实际暂停状态不一致的步数
+    int64_t max_repause_ms = 0;   // 切换后到在新设备上重新暂停
+    uint64_t late_repauses = 0;   // 切换后连续 active_probes 次探到声音仍没有重新暂停
+};
+
+// 100 ms 一步。我们的流在没有暂停时一直开着，重启本身不计时间。暂停状态由 KeepAliveCore 持有，
+// flag 按 keepalive_log 的做法更新：每次探测后和每次生命周期决策后
+static void sim_other_audio(std::mt19937_64& rng, const std::vector<OtherSeg>& segs, OtherAudioResult& r) {
+    const int64_t STEP_MS = 100;
+    OtherAudioDetector det;
+    KeepAliveCore core(nullptr);
+    const wchar_t* sinks[2] = { L"{sink-a}", L"{sink-b}" };
+    int sink = 0;
+    core.set_default(sinks[sink], L"Sink A");
+    bool flag = false;
+    int64_t switched_ms = -1;
+    int loud_probes = 0;   // 切换后连续探到声音的次数
+    int64_t probe_ms = det.config().probe_ms;
+    int64_t phase = (int64_t)(rng() % (uint64_t)(probe_ms / STEP_MS)) * STEP_MS;
+    int64_t idle_since = -1;
+    OtherSegKind last_loud = OS_IDLE;   // 最近一次探测到声音时在放什么
+    size_t i = 0;
+    int64_t end_ms = segs.back().end_ms;
+    for (int64_t t = 0; t < end_ms; t += STEP_MS) {
+        while (segs[i].end_ms <= t) i++;
+        const OtherSeg& seg = segs[i];
+        float peak = 0.0f;
+        if (seg.kind == OS_TRACK) {
+            if (t - seg.start_ms < seg.intro_ms) peak = 0.0005f;
+            else if (rng() % 100 != 0) peak = seg.level * (0.3f + (float)(rng() % 70) / 100.0f);
+        } else if (seg.kind == OS_BEEP) {
+            peak = seg.level;
+        }
+
+        // 暂停中（平均每半小时一次）切换默认设备，音乐跟着到新设备上
+        if (core.paused() && rng() % 18000 == 0) {
+            sink ^= 1;
+            core.apply(make_device_event(t * 1000, EV_DEFAULT_CHANGED, sinks[sink], DEVICE_STATE_ACTIVE_VALUE, L"Sink"));
+            core.decide();
+            flag = core.paused();
+            r.switches++;
+            switched_ms = t;
+            loud_probes = 0;
+        }
+        bool loud = seg.kind == OS_TRACK && t - seg.start_ms >= seg.intro_ms;
+        if (switched_ms >= 0 && !loud) switched_ms = seg.kind == OS_TRACK ? t + STEP_MS : -1;   // 前奏不算，音乐停了就不再等
+
+        if (t % probe_ms == phase) {
+            bool was = core.paused();
+            if (peak >= det.config().on_level) last_loud = seg.kind;
+            bool now = core.apply_other_audio(det, t, peak, seg.kind == OS_IDLE ? 0 : 1);
+            loud_probes = peak >= det.config().on_level ? loud_probes + 1 : 0;
+            if (switched_ms >= 0 && loud_probes >= det.config().active_probes && !now) r.late_repauses++;
+            flag = now;
+            if (core.pending()) core.decide();
+            if (now && !was) {
+                r.pauses++;
+                if (last_loud == OS_BEEP && switched_ms < 0) r.beep_pauses++;
+                if (switched_ms >= 0 && t - switched_ms > r.max_repause_ms) r.max_repause_ms = t - switched_ms;
+                switched_ms = -1;
+            } else if (!now && was) {
+                r.resumes++;
+                if (seg.kind == OS_TRACK && t - seg.start_ms >= seg.intro_ms) r.false_resumes++;
+            }
+        }
+
+        if (flag != core.paused()) r.stale_flags++;
+        if (loud) {
+            r.loud_ms += STEP_MS;
+            if (core.paused()) r.loud_paused_ms += STEP_MS;
+        }
+        bool awake = !core.paused() || seg.kind != OS_IDLE;
+        if (awake) {
+            idle_since = -1;
+        } else {
+            if (idle_since < 0) idle_since = t;
+            if (t + STEP_MS - idle_since > r.max_idle_ms) r.max_idle_ms = t + STEP_MS - idle_since;
+        }
+    }
+}
+
+static int run_otheraudio(int argc, char** argv) {
+    size_t listeners = 200;
+    double hours = 24;
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--listeners" && i + 1 < argc) listeners = (size_t)atoll(argv[++i]);
+        else if (a == "--hours" && i + 1 < argc) hours = atof(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s otheraudio [--listeners n] [--hours h]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (listeners == 0 || hours <= 0) return 1;
+
+    std::mt19937_64 rng(0x6f74686572);
+    int64_t end_ms = (int64_t)(hours * 3600000);
+    OtherAudioResult total;
+    std::vector<OtherSeg> segs;
+    auto wall0 = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < listeners; n++) {
+        segs.clear();
+        other_audio_timeline(rng, end_ms, segs);
+        OtherAudioResult r;
+        sim_other_audio(rng, segs, r);
+        if (r.max_idle_ms > total.max_idle_ms) total.max_idle_ms = r.max_idle_ms;
+        total.loud_ms += r.loud_ms;
+        total.loud_paused_ms += r.loud_paused_ms;
+        total.pauses += r.pauses;
+        total.resumes += r.resumes;
+        total.false_resumes += r.false_resumes;
+        total.beep_pauses += r.beep_pauses;
+        total.switches += r.switches;
+        total.stale_flags += r.stale_flags;
+        if (r.max_repause_ms > total.max_repause_ms) total.max_repause_ms = r.max_repause_ms;
+        total.late_repauses += r.late_repauses;
+    }
+    double wall_s = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - wall0).count() / 1000.0;
+
+    double covered = total.loud_ms ? (double)total.loud_paused_ms / (double)total.loud_ms : 1.0;
+    bool idle_ok = total.max_idle_ms <= 10000;
+    bool covered_ok = covered >= 0.95;
+    OtherAudioDetector::Config cfg;
+    bool switch_ok = total.switches > 0 && total.stale_flags == 0 && total.late_repauses == 0;
+    printf("listeners         %zu, %.1f virtual hours each, probe every %lld ms, %.1f s wall\n",
+           listeners, hours, (long long)cfg.probe_ms, wall_s);
+    printf("pauses            %llu paused, %llu resumed\n", (unsigned long long)total.pauses, (unsigned long long)total.resumes);
+    printf("loud music        %.1f h, keepalive paused for %.2f%% of it\n", total.loud_ms / 3600000.0, covered * 100);
+    printf("longest idle      %.1f s with neither stream open\n", total.max_idle_ms / 1000.0);
+    printf("device switches   %llu while paused, paused again on the new device within %.1f s (%llu late), %llu steps with a stale flag\n",
+           (unsigned long long)total.switches, total.max_repause_ms / 1000.0, (unsigned long long)total.late_repauses,
+           (unsigned long long)total.stale_flags);
+    printf("invariants        idle under 10 s %s, no resumes mid-track %s (%llu), beeps ignored %s (%llu), "
+           "paused during music %s, switch while paused %s\n",
+           idle_ok ? "OK" : "FAIL", total.false_resumes ? "FAIL" : "OK", (unsigned long long)total.false_resumes,
+           total.beep_pauses ? "FAIL" : "OK", (unsigned long long)total.beep_pauses, covered_ok ? "OK" : "FAIL",
+           switch_ok ? "OK" : "FAIL");
+    return !idle_ok || total.false_resumes || total.beep_pauses || !covered_ok || !switch_ok ? 2 : 0;
+}
+
+// ===== handover =====
+// 模拟流后端：时间是微秒，open/close 本身推进时钟。流从 open 返回时开始出声，从 close 开始时停止
+// （按最不利的情况算）。active 是每个 endpoint 上的流数，zero_us 累计第一次开流之后一路流都没有的时长。
+struct HandoverWorld {
+    std::mt19937_64 rng{ 0x68616e64 };
+    int64_t now_us = 0;
+    std::vector<int> active;
+    std::vector<int64_t> ready_us;   // 设备在这之前开流失败
+    int total = 0;
+    int max_total = 0;
+    bool started = false;
+    bool stopped = false;            // 调用方主动停止，停着的时间不算断流
+    int64_t zero_since_us = -1;
+    int64_t zero_us = 0;
+    uint64_t zero_gaps = 0;
+    uint64_t opens = 0;
+    uint64_t failed_opens = 0;
+
+    void set_total(int delta) {
+        total += delta;
+        if (total > max_total) max_total = total;
+        if (total == 0 && started && !stopped) {
+            zero_since_us = now_us;
+            zero_gaps++;
+        } else if (total > 0 && zero_since_us >= 0) {
+            zero_us += now_us - zero_since_us;
+            zero_since_us = -1;
+        }
+        if (total > 0) started = true;
+    }
+};
+
+struct SimStreamBackend {
+    typedef int Stream;   // endpoint 下标 + 1，0 表示失败
+    HandoverWorld* w = nullptr;
+
+    Stream open(const wchar_t* id) {
+        int ep = (int)wcstol(id, nullptr, 10);
+        w->now_us += 2000 + (int64_t)(w->rng() % 148000);
+        if (w->now_us < w->ready_us[ep]) {
+            w->failed_opens++;
+            return 0;
+        }
+        w->opens++;
+        w->active[ep]++;
+        w->set_total(1);
+        return ep + 1;
+    }
+
+    void close(Stream s) {
+        w->active[s - 1]--;
+        w->set_total(-1);
+        w->now_us += 500 + (int64_t)(w->rng() % 30000);
+    }
+
+    int64_t now_us() { return w->now_us; }
+};
+
+struct HandoverResult {
+    uint64_t switches = 0;
+    uint64_t handovers = 0;
+    uint64_t retries = 0;
+    uint64_t negative_overlaps = 0;
+    uint64_t leaked = 0;
+    LatencyHistogram setup_us;
+    LatencyHistogram overlap_us;
+};
+
+// make_before_break 为 false 时先 stop() 再 play()，即原来 PlaySound 的做法
+static void sim_handover(HandoverWorld& w, size_t sinks, uint64_t switches, bool make_before_break, HandoverResult& r) {
+    SimStreamBackend b;
+    b.w = &w;
+    StreamHandover<SimStreamBackend> player(b);
+    std::mt19937_64 rng(0x737769746368);
+    wchar_t id[32];
+    int cur = -1;
+    for (uint64_t n = 0; n < switches; n++) {
+        int next = (int)(rng() % sinks);
+        if (rng() % 20 == 0 && cur >= 0) next = cur;   // 同一设备上重建（卡死后重启）
+        // 刚连上的蓝牙设备有时要等几百毫秒音频引擎才开得起流
+        if (next != cur && rng() % 4 == 0) w.ready_us[next] = w.now_us + (int64_t)(rng() % 800000);
+        swprintf(id, 32, L"%d", next);
+        uint64_t handovers = player.handovers();
+        if (!make_before_break) player.stop();
+        while (!player.play(id)) {
+            r.retries++;
+            w.now_us += 25000;
+        }
+        if (player.handovers() != handovers) {
+            r.handovers++;
+            r.setup_us.record(player.last_setup_us());
+            if (player.last_overlap_us() < 0) r.negative_overlaps++;
+            r.overlap_us.record(player.last_overlap_us());
+        }
+        if (next != cur && cur >= 0) r.switches++;
+        cur = next;
+        w.now_us += 100000 + (int64_t)(rng() % 60000000);
+    }
+    w.stopped = true;
+    player.stop();
+    for (int a : w.active) r.leaked += (uint64_t)a;
+}
+
+static int run_handover(int argc, char** argv) {
+    size_t sinks = 4;
+    uint64_t switches = 100000;
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--sinks" && i + 1 < argc) sinks = (size_t)atoll(argv[++i]);
+        else if (a == "--switches" && i + 1 < argc) switches = (uint64_t)atoll(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s handover [--sinks n] [--switches n]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (sinks < 2 || switches == 0) return 1;
+
+    HandoverWorld mbb, bbm;
+    mbb.active.assign(sinks, 0);
+    mbb.ready_us.assign(sinks, 0);
+    bbm.active.assign(sinks, 0);
+    bbm.ready_us.assign(sinks, 0);
+    HandoverResult r, base;
+    sim_handover(mbb, sinks, switches, true, r);
+    sim_handover(bbm, sinks, switches, false, base);
+
+    LatencyHistogram::Snapshot setup, overlap;
+    r.setup_us.snapshot(setup);
+    r.overlap_us.snapshot(overlap);
+    bool no_gap = mbb.zero_gaps == 0 && mbb.zero_us == 0;
+    bool handovers_ok = r.handovers == r.switches;
+    bool bounded = mbb.max_total <= 2;
+    bool leak_free = r.leaked == 0 && mbb.total == 0 && base.leaked == 0;
+    bool baseline_caught = bbm.zero_gaps > 0;
+    printf("sinks             %zu, %llu switches (%llu to another device), %.1f virtual hours\n",
+           sinks, (unsigned long long)switches, (unsigned long long)r.switches, mbb.now_us / 3.6e9);
+    printf("make-before-break %llu handovers, %llu failed opens retried, zero-stream gaps %llu (%.1f ms total), max %d streams\n",
+           (unsigned long long)r.handovers, (unsigned long long)r.retries, (unsigned long long)mbb.zero_gaps,
+           mbb.zero_us / 1000.0, mbb.max_total);
+    printf("  new side        setup p50 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+           setup.percentile(50) / 1000.0, setup.percentile(99) / 1000.0, setup.max() / 1000.0);
+    printf("  old side        overlap p50 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+           overlap.percentile(50) / 1000.0, overlap.percentile(99) / 1000.0, overlap.max() / 1000.0);
+    printf("break-before-make zero-stream gaps %llu (%.1f ms total, %.1f ms per switch)\n",
+           (unsigned long long)bbm.zero_gaps, bbm.zero_us / 1000.0,
+           bbm.zero_gaps ? bbm.zero_us / 1000.0 / bbm.zero_gaps : 0.0);
+    printf("invariants        never zero streams %s, every switch handed over %s, at most two streams %s, "
+           "overlap not negative %s (%llu), no leaks %s, baseline gaps detected %s\n",
+           no_gap ? "OK" : "FAIL", handovers_ok ? "OK" : "FAIL", bounded ? "OK" : "FAIL",
+           r.negative_overlaps ? "FAIL" : "OK", (unsigned long long)r.negative_overlaps, leak_free ? "OK" : "FAIL",
+           baseline_caught ? "OK" : "FAIL");
+    return !no_gap || !handovers_ok || !bounded || r.negative_overlaps || !leak_free || !baseline_caught ? 2 : 0;
+}
+
+// ===== streampool =====
+struct PoolEndpoint {
+    std::wstring id;
+    std::vector<uint8_t> format;
+    int64_t negotiate_us;
+};
+
+static void random_format(std::mt19937_64& rng, std::vector<uint8_t>& out) {
+    out.assign(rng() % 3 ? 40 : 18, 0);   // WAVEFORMATEXTENSIBLE 或 WAVEFORMATEX
+    for (uint8_t& b : out) b = (uint8_t)rng();
+}
+
+static int run_streampool(int argc, char** argv) {
+    size_t endpoints = 40;
+    uint64_t reconnects = 1000000;
+    StreamConfigPool::Config cfg;
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--endpoints" && i + 1 < argc) endpoints = (size_t)atoll(argv[++i]);
+        else if (a == "--reconnects" && i + 1 < argc) reconnects = (uint64_t)atoll(argv[++i]);
+        else if (a == "--max-entries" && i + 1 < argc) cfg.max_entries = (size_t)atoll(argv[++i]);
+        else if (a == "--max-bytes" && i + 1 < argc) cfg.max_bytes = (size_t)atoll(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s streampool [--endpoints n] [--reconnects n] [--max-entries n] [--max-bytes n]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (endpoints == 0) return 1;
+
+    std::mt19937_64 rng(0x706f6f6c);
+    std::vector<PoolEndpoint> eps(endpoints);
+    std::vector<double> weight(endpoints);
+    for (size_t i = 0; i < endpoints; i++) {
+        wchar_t id[DEVICE_ID_LEN];
+        swprintf(id, DEVICE_ID_LEN, L"{0.0.0.00000000}.{%08x-0000-0000-0000-%012zx}", (unsigned)rng(), i);
+        eps[i].id = id;
+        random_format(rng, eps[i].format);
+        eps[i].negotiate_us = 500 + (int64_t)(rng() % 19500);
+        weight[i] = 1.0 / pow((double)(i + 1), 1.2);
+    }
+    std::discrete_distribution<size_t> pick(weight.begin(), weight.end());
+
+    StreamConfigPool pool(cfg);
+    // 朴素 LRU 模型：0 是最近用过的，条目大小按同样的公式独立计算
+    std::vector<std::pair<std::wstring, size_t>> model;
+    uint64_t order_errors = 0, bound_errors = 0, stale_failures = 0, format_changes = 0;
+    uint64_t hits = 0, misses = 0;   // 只有缓存的格式真的用上才算命中
+    int64_t negotiated_us = 0, saved_us = 0;
+    auto model_find = [&](const std::wstring& id) {
+        return std::find_if(model.begin(), model.end(), [&](const std::pair<std::wstring, size_t>& m) { return m.first == id; });
+    };
+    auto model_put = [&](const PoolEndpoint& e) {
+        auto it = model_find(e.id);
+        if (it != model.end()) model.erase(it);
+        size_t bytes = sizeof(StreamConfigPool::Entry) + e.id.size() * sizeof(wchar_t) + e.format.size();
+        if (bytes > cfg.max_bytes || !cfg.max_entries) return;
+        model.insert(model.begin(), std::make_pair(e.id, bytes));
+        size_t total = 0;
+        for (const auto& m : model) total += m.second;
+        while (model.size() > cfg.max_entries || total > cfg.max_bytes) {
+            total -= model.back().second;
+            model.pop_back();
+        }
+    };
+
+    auto wall0 = std::chrono::steady_clock::now();
+    for (uint64_t n = 0; n < reconnects; n++) {
+        PoolEndpoint& e = eps[pick(rng)];
+        if (rng() % 1000 == 0) {
+            random_format(rng, e.format);   // 用户在声音设置里改了格式
+            format_changes++;
+        }
+        const StreamConfigPool::Entry* hit = pool.get(e.id.c_str());
+        auto m = model_find(e.id);
+        if ((hit != nullptr) != (m != model.end())) order_errors++;
+        if (hit && hit->format != e.format) {
+            // 用缓存的格式初始化失败：丢掉缓存，下一次重连重新协商
+            stale_failures++;
+            misses++;
+            pool.reject_hit(e.id.c_str());
+            if (m != model.end()) model.erase(m);
+        } else if (hit) {
+            hits++;
+            saved_us += hit->negotiate_us;
+            pool.confirm_hit(e.id.c_str());
+            if (m != model.end()) std::rotate(model.begin(), m, m + 1);
+        } else {
+            misses++;
+            negotiated_us += e.negotiate_us;
+            pool.put(e.id.c_str(), e.format.data(), e.format.size(), 20000000, e.negotiate_us);
+            model_put(e);
+        }
+
+        size_t bytes = 0;
+        for (size_t i = 0; i < pool.size(); i++) bytes += pool.at(i).bytes();
+        if (pool.size() > cfg.max_entries || pool.bytes() > cfg.max_bytes || bytes != pool.bytes()) bound_errors++;
+        bool same = pool.size() == model.size();
+        for (size_t i = 0; same && i < model.size(); i++) same = pool.at(i).id == model[i].first && pool.at(i).bytes() == model[i].second;
+        if (!same) order_errors++;
+    }
+    double wall_s = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - wall0).count() / 1000.0;
+
+    uint64_t lookups = pool.hits() + pool.misses();
+    double hit_rate = lookups ? (double)pool.hits() / lookups : 0;
+    bool stale_ok = stale_failures <= format_changes;
+    bool counted_ok = pool.hits() == hits && pool.misses() == misses && pool.saved_us() == saved_us;
+    printf("endpoints         %zu, %llu reconnects, pool limit %zu entries / %zu bytes, %.1f s wall\n",
+           endpoints, (unsigned long long)reconnects, cfg.max_entries, cfg.max_bytes, wall_s);
+    printf("pool              hit rate %.1f%% (%llu hits, %llu misses), %llu evictions, %zu entries / %zu bytes at the end\n",
+           hit_rate * 100, (unsigned long long)pool.hits(), (unsigned long long)pool.misses(),
+           (unsigned long long)pool.evictions(), pool.size(), pool.bytes());
+    printf("setup time        %.1f s negotiated, %.1f s saved (%.0f%%)\n", negotiated_us / 1e6, pool.saved_us() / 1e6,
+           negotiated_us + pool.saved_us() ? pool.saved_us() * 100.0 / (negotiated_us + pool.saved_us()) : 0.0);
+    printf("format changes    %llu, %llu opens failed on a stale cached format\n",
+           (unsigned long long)format_changes, (unsigned long long)stale_failures);
+    printf("invariants        LRU order %s (%llu), within limits %s (%llu), stale formats retried once %s, "
+           "only used formats counted as hits %s\n",
+           order_errors ? "FAIL" : "OK", (unsigned long long)order_errors, bound_errors ? "FAIL" : "OK",
+           (unsigned long long)bound_errors, stale_ok ? "OK" : "FAIL", counted_ok ? "OK" : "FAIL");
+    return order_errors || bound_errors || !stale_ok || !counted_ok ? 2 : 0;
+}
+
+// ===== statuspage =====
+static void fill_status(KeepaliveStatusData& d, uint64_t v) {
+    d.playing = (uint32_t)(v & 1);
+    d.blocked = (uint32_t)(v >> 1 & 1);
+    d.notifications = d.restarts = d.playback_failures = v;
+    d.start_unix_ms = d.last_change_unix_ms = v;
+    d.cpu_time_ms = d.private_bytes = d.working_set_bytes = d.wakeups = v;
+    d.handle_count = d.reserved = (uint32_t)v;
+    for (size_t i = 0; i < 128; i++) {
+        d.endpoint_id[i] = (uint16_t)(v + i);
+        d.device_name[i] = (uint16_t)(v * 3 + i);
+    }
+}
+
+static bool status_consistent(const KeepaliveStatusData& d) {
+    KeepaliveStatusData want;
+    fill_status(want, d.notifications);
+    return memcmp(&want, &d, sizeof(d)) == 0;
+}
+
+// 模拟写端崩溃：发布 n 个快照后写到一半就“死掉”，只做进程退出时系统会做的事（解除映射、关句柄），
+// 不走 keepalive_status_unmap。死掉之前先给 reader 映射一个一直开着的读视图，状态页因此留下来。
+// 在单独的线程里做：Windows 的写端互斥量属于线程，线程退出后被遗弃，与进程崩溃相同。
+// 返回崩溃时的 seq；映射失败返回 0
+static uint32_t crash_status_writer(uint64_t n, KeepaliveStatusMapping& reader) {
+    uint32_t seq = 0;
+    std::thread t([&] {
+        KeepaliveStatusMapping m = {};
+        if (!keepalive_status_map(m, true)) return;
+        KeepaliveStatusData d;
+        for (uint64_t v = 1; v <= n; v++) {
+            fill_status(d, v);
+            keepalive_status_publish(m.page, d);
+        }
+        keepalive_status_map(reader, false);
+        seq = m.page->seq.load(std::memory_order_relaxed) + 1;
+        m.page->seq.store(seq, std::memory_order_relaxed);
+        fill_status(d, n + 1);
+        memcpy(&m.page->data, &d, sizeof(d) / 2);
+#ifdef _WIN32
+        UnmapViewOfFile(m.page);
+        CloseHandle(m.handle);
+        CloseHandle(m.writer_lock);
+#else
+        munmap(m.page, sizeof(KeepaliveStatusPage));
+        close(m.fd);
+#endif
+    });
+    t.join();
+    return seq;
+}
+
+static int run_statuspage(int argc, char** argv) {
+    int readers = 4;
+    double seconds = 5;
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--readers" && i + 1 < argc) readers = atoi(argv[++i]);
+        else if (a == "--seconds" && i + 1 < argc) seconds = atof(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s statuspage [--readers n] [--seconds s]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (readers <= 0 || seconds <= 0) return 1;
+
+    // 先留下一个崩溃的写端和一直开着视图的读者，再由新的写端接手
+    KeepaliveStatusMapping stale_reader = {};
+    uint32_t stale_seq = crash_status_writer(1000, stale_reader);
+    KeepaliveStatusMapping m = {};
+    KeepaliveStatusPage local;
+    KeepaliveStatusPage* page = &local;
+    bool mapped = keepalive_status_map(m, true);
+    bool second_refused = true, took_over = true;
+    if (mapped) {
+        page = m.page;
+        uint32_t seq = page->seq.load(std::memory_order_relaxed);
+        KeepaliveStatusData d;
+        took_over = stale_seq == 0 || ((seq & 1) == 0 && seq > stale_seq && keepalive_status_read(page, d));
+        // 互斥量可重入，第二个写端要在另一个线程上试
+        std::thread([&] {
+            KeepaliveStatusMapping again = {};
+            second_refused = !keepalive_status_map(again, true);
+            if (!second_refused) keepalive_status_unmap(again);
+        }).join();
+    } else {
+        keepalive_status_init(page);
+    }
+
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> published(0);
+    std::thread writer([&] {
+        KeepaliveStatusData d;
+        for (uint64_t v = 1; !stop.load(std::memory_order_relaxed); v++) {
+            fill_status(d, v);
+            keepalive_status_publish(page, d);
+            published.store(v, std::memory_order_relaxed);
+        }
+    });
+    std::vector<uint64_t> reads(readers), torn(readers), regressed(readers), busy(readers);
+    std::vector<std::thread> pool;
+    for (int r = 0; r < readers; r++) {
+        pool.emplace_back([&, r] {
+            KeepaliveStatusData d;
+            uint64_t last = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (!keepalive_status_read(page, d)) {
+                    busy[r]++;
+                    continue;
+                }
+                reads[r]++;
+                if (!status_consistent(d)) torn[r]++;
+                else if (d.notifications < last) regressed[r]++;
+                else last = d.notifications;
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds((int64_t)(seconds * 1000)));
+    stop = true;
+    writer.join();
+    for (std::thread& t : pool) t.join();
+    // 崩溃前就开着的读视图应该看到新写端最后发布的快照
+    bool stale_reader_ok = true;
+    if (stale_reader.page) {
+        KeepaliveStatusData d;
+        stale_reader_ok = keepalive_status_read(stale_reader.page, d) && status_consistent(d) &&
+                          d.notifications == published.load();
+        keepalive_status_unmap(stale_reader);
+    }
+    if (mapped) keepalive_status_unmap(m);
+
+    uint64_t total_reads = 0, total_torn = 0, total_regressed = 0, total_busy = 0;
+    for (int r = 0; r < readers; r++) {
+        total_reads += reads[r];
+        total_torn += torn[r];
+        total_regressed += regressed[r];
+        total_busy += busy[r];
+    }
+    printf("status page       %s, %d readers, %.1f s\n", mapped ? "shared memory" : "in-process (shared memory unavailable)", readers, seconds);
+    printf("writer            %llu snapshots published\n", (unsigned long long)published.load());
+    printf("readers           %llu snapshots read, %llu reads gave up after retrying\n",
+           (unsigned long long)total_reads, (unsigned long long)total_busy);
+    if (stale_seq)
+        printf("takeover          crashed writer left seq %u, new writer %s, reader mapped before the crash %s\n",
+               stale_seq, took_over ? "continued it" : "FAILED to take over", stale_reader_ok ? "sees new snapshots" : "FAILED");
+    else
+        printf("takeover          skipped (shared memory unavailable)\n");
+    printf("invariants        no torn reads %s (%llu), no regressions %s (%llu), second writer refused %s, takeover %s\n",
+           total_torn ? "FAIL" : "OK", (unsigned long long)total_torn, total_regressed ? "FAIL" : "OK",
+           (unsigned long long)total_regressed, second_refused ? "OK" : "FAIL", took_over && stale_reader_ok ? "OK" : "FAIL");
+    return total_torn || total_regressed || !second_refused || !took_over || !stale_reader_ok || total_reads == 0 ? 2 : 0;
+}
+
+// ===== histogram =====
+static int run_histogram(int argc, char** argv) {
+    uint64_t samples = 1000000;
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--samples" && i + 1 < argc) samples = (uint64_t)atoll(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s histogram [--samples n]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    typedef LatencyHistogram H;
+    static H h;
+    std::vector<int64_t> values;
+    for (int i = 0; i < H::BUCKETS; i++) {
+        for (int64_t d = -1; d <= 1; d++) {
+            int64_t v = H::bucket_low(i) + d;
+            if (v >= 0) values.push_back(v);
+        }
+    }
+    std::mt19937_64 rng(0x68697374);
+    for (uint64_t n = 0; n < samples; n++) {
+        // 对数均匀：1 µs 到约 1 小时
+        values.push_back((int64_t)exp(std::uniform_real_distribution<double>(0.0, log(3.6e9))(rng)));
+    }
+    for (int64_t v : values) h.record(v);
+    std::sort(values.begin(), values.end());
+    H::Snapshot snap;
+    h.snapshot(snap);
+
+    std::vector<int64_t> limits = { 100000 };   // keepalive_log 的 LATENCY_SLO_US
+    // keepalive_log 的 PROM_LATENCY_BUCKETS_S 和 PROM_HANG_BUCKETS_S
+    for (double le : { 0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1.0, 2.0, 5.0, 10.0, 30.0, 60.0, 300.0, 1800.0 })
+        limits.push_back((int64_t)(le * 1000000));
+    for (int i = 0; i < H::BUCKETS - 1; i++) {
+        limits.push_back(H::bucket_low(i));
+        limits.push_back(H::bucket_high(i));
+    }
+    uint64_t over = 0, inexact = 0, too_low = 0, checked = 0;
+    for (int64_t limit : limits) {
+        uint64_t exact = (uint64_t)(std::upper_bound(values.begin(), values.end(), limit) - values.begin());
+        uint64_t got = snap.count_at_or_below(limit);
+        int b = H::bucket_of((uint64_t)limit);
+        checked++;
+        if (got > exact) over++;
+        else if (limit == H::bucket_high(b) && got != exact) inexact++;
+        else if (exact - got > snap.counts[b]) too_low++;
+    }
+    printf("histogram         %zu samples, %llu limits checked (every bucket edge, the 100 ms SLO, the Prometheus le edges)\n",
+           values.size(), (unsigned long long)checked);
+    printf("invariants        never above the true count %s (%llu), exact at bucket upper bounds %s (%llu), "
+           "short by at most the straddling bucket %s (%llu)\n",
+           over ? "FAIL" : "OK", (unsigned long long)over, inexact ? "FAIL" : "OK", (unsigned long long)inexact,
+           too_low ? "FAIL" : "OK", (unsigned long long)too_low);
+    return over || inexact || too_low ? 2 : 0;
+}
+
+int main(int argc, char** argv) {
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (mode == "replay") return run_replay(argc, argv);
+    if (mode == "stress") return run_stress(argc, argv);
+    if (mode == "soak") return run_soak(argc, argv);
+    if (mode == "allocs") return run_allocs(argc, argv);
+    if (mode == "lifecycle") return run_lifecycle(argc, argv);
+    if (mode == "dutycycle") return run_dutycycle(argc, argv);
+    if (mode == "learn") return run_learn(argc, argv);
+    if (mode == "otheraudio") return run_otheraudio(argc, argv);
+    if (mode == "handover") return run_handover(argc, argv);
+    if (mode == "streampool") return run_streampool(argc, argv);
+    if (mode == "statuspage") return run_statuspage(argc, argv);
+    if (mode == "histogram") return run_histogram(argc, argv);
+    fprintf(stderr, "usage: %s replay|stress|soak|allocs|lifecycle|dutycycle|learn|otheraudio|handover|streampool|statuspage|histogram [options]\n", argv[0]);
+    return 1;
+}
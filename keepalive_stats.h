@@ -0,0 +1,108 @@
+// keepalive_stats.h
+// 不依赖 Windows 的统计工具，keepalive_log.cpp 与 Linux 下的工具共用
+#ifndef KEEPALIVE_STATS_H
+#define KEEPALIVE_STATS_H
+
+#include <stdint.h>
+#include <atomic>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// ===== 对数分桶延迟直方图（HDR 风格）=====
+// 单位微秒。每个 2 的幂区间再分 16 个子桶，相对误差约 6%，覆盖到约 9.5 小时。
+// record() 只有两次 relaxed 原子加（桶计数和总和），没有锁，可以在任何线程、回调里调用。
+class LatencyHistogram {
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB = 1 << SUB_BITS;
+    static const int MAX_MSB = 35;
+    static const int BUCKETS = (MAX_MSB - SUB_BITS + 2) * SUB;
+
+    void record(int64_t us) {
+        if (us < 0) us = 0;
+        counts_[bucket_of((uint64_t)us)].fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add((uint64_t)us, std::memory_order_relaxed);
+    }
+
+    // 把当前计数拷贝出来，之后的统计都在副本上做
+    struct Snapshot {
+        uint64_t counts[BUCKETS];
+        uint64_t total;
+        uint64_t sum;                 // 微秒，与 counts 不是同一时刻读取，只作近似
+
+        // p 取 0..100，返回桶的中点（微秒）
+        int64_t percentile(double p) const {
+            if (total == 0) return 0;
+            uint64_t rank = (uint64_t)(p / 100.0 * (double)total + 0.5);
+            if (rank < 1) rank = 1;
+            if (rank > total) rank = total;
+            uint64_t seen = 0;
+            for (int i = 0; i < BUCKETS; i++) {
+                seen += counts[i];
+                if (seen >= rank) return bucket_mid(i);
+            }
+            return bucket_mid(BUCKETS - 1);
+        }
+        int64_t max() const {
+            for (int i = BUCKETS - 1; i >= 0; i--)
+                if (counts[i]) return bucket_mid(i);
+            return 0;
+        }
+        // 确定不超过 limit_us 的样本数：只算上界不超过 limit_us 的桶，跨过 limit_us 的那个桶整个不算，
+        // 结果只会偏少，符合 Prometheus le 的语义。limit_us 正好是某个桶的上界时是精确值
+        uint64_t count_at_or_below(int64_t limit_us) const {
+            uint64_t n = 0;
+            for (int i = 0; i < BUCKETS && bucket_high(i) <= limit_us; i++) n += counts[i];
+            return n;
+        }
+    };
+
+    void snapshot(Snapshot& out) const {
+        out.sum = sum_.load(std::memory_order_relaxed);
+        out.total = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            out.counts[i] = counts_[i].load(std::memory_order_relaxed);
+            out.total += out.counts[i];
+        }
+    }
+
+    static int bucket_of(uint64_t v) {
+        if (v < (uint64_t)SUB) return (int)v;
+        int msb = msb_index(v);
+        if (msb > MAX_MSB) return BUCKETS - 1;
+        return (msb - SUB_BITS + 1) * SUB + (int)((v >> (msb - SUB_BITS)) - SUB);
+    }
+    static int64_t bucket_low(int i) {
+        if (i < SUB) return i;
+        int msb = i / SUB + SUB_BITS - 1;
+        return (int64_t)(SUB + i % SUB) << (msb - SUB_BITS);
+    }
+    // 桶里可能的最大值；最后一个桶还装着所有溢出的样本，没有上界
+    static int64_t bucket_high(int i) {
+        if (i >= BUCKETS - 1) return INT64_MAX;
+        return bucket_low(i + 1) - 1;
+    }
+    static int64_t bucket_mid(int i) {
+        if (i < SUB) return i;
+        int msb = i / SUB + SUB_BITS - 1;
+        return bucket_low(i) + ((int64_t)1 << (msb - SUB_BITS)) / 2;
+    }
+
+private:
+    static int msb_index(uint64_t v) {
+#ifdef _MSC_VER
+        unsigned long idx;
+        _BitScanReverse64(&idx, v);
+        return (int)idx;
+#else
+        return 63 - __builtin_clzll(v);
+#endif
+    }
+
+    std::atomic<uint64_t> counts_[BUCKETS] = {};
+    std::atomic<uint64_t> sum_{ 0 };
+};
+
+#endif
@@ -0,0 +1,189 @@
+// keepalive_status.h
+// keepalive_log 共享内存状态页的布局与读写函数。
+// 外部监控程序只需包含本文件：keepalive_status_map(m, false) 映射只读视图，
+// keepalive_status_read() 通过 seqlock 拿到一致的快照，不需要和 keepalive_log 进程通信；
+// 用完 keepalive_status_unmap()。视图可以一直开着：keepalive_log 重启后接手同一个状态页，seq 接着往上加。
+// keepalive_log 退出后状态页可能还在，内容停在最后一次发布（资源数据每分钟至少发布一次，seq 长时间不变即可判断）。
+#ifndef KEEPALIVE_STATUS_H
+#define KEEPALIVE_STATUS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+#ifdef _WIN32
+#include <windows.h>
+#define KEEPALIVE_STATUS_SHM_NAME L"Local\\keepalive_log_status"
+#define KEEPALIVE_STATUS_WRITER_MUTEX L"Local\\keepalive_log_status_writer"
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define KEEPALIVE_STATUS_SHM_NAME "/keepalive_log_status"
+#endif
+
+#define KEEPALIVE_STATUS_MAGIC 0x534C414Bu   // "KALS"
+#define KEEPALIVE_STATUS_VERSION 2u
+
+// 字符串一律是以 0 结尾的 UTF-16，保证各平台布局一致
+struct KeepaliveStatusData {
+    uint32_t playing;
+    uint32_t blocked;
+    uint64_t notifications;
+    uint64_t restarts;
+    uint64_t playback_failures;
+    uint64_t start_unix_ms;
+    uint64_t last_change_unix_ms;   // 设备或播放状态最近一次变化的时间
+    // 资源监控，每分钟采样一次
+    uint64_t cpu_time_ms;           // 累计 CPU 时间
+    uint64_t private_bytes;
+    uint64_t working_set_bytes;
+    uint64_t wakeups;               // 累计线程唤醒次数
+    uint32_t handle_count;
+    uint32_t reserved;
+    uint16_t endpoint_id[128];
+    uint16_t device_name[128];
+};
+
+struct KeepaliveStatusPage {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;                  // sizeof(KeepaliveStatusPage)，用于校验布局
+    std::atomic<uint32_t> seq;      // 奇数表示正在写
+    KeepaliveStatusData data;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "seqlock needs a lock-free 32-bit atomic");
+
+// ===== 写端（只允许一个线程调用）=====
+inline void keepalive_status_init(KeepaliveStatusPage* page) {
+    memset(&page->data, 0, sizeof(page->data));
+    page->seq.store(0, std::memory_order_relaxed);
+    page->magic = KEEPALIVE_STATUS_MAGIC;
+    page->version = KEEPALIVE_STATUS_VERSION;
+    page->size = (uint32_t)sizeof(KeepaliveStatusPage);
+}
+
+// 接手已有的状态页：布局对得上就保留 seq 接着往上加，一直开着视图的读者看到的序号不会倒退；
+// 对不上（新建的全零页或旧版本）就重新初始化。上一个写端死在写到一半时 seq 是奇数，
+// 先把数据清零结束这次写，读者不会把写了一半的数据当成快照。
+inline void keepalive_status_adopt(KeepaliveStatusPage* page) {
+    if (page->magic != KEEPALIVE_STATUS_MAGIC || page->version != KEEPALIVE_STATUS_VERSION ||
+        page->size != sizeof(KeepaliveStatusPage)) {
+        keepalive_status_init(page);
+        return;
+    }
+    uint32_t s = page->seq.load(std::memory_order_relaxed);
+    if (s & 1) {
+        memset(&page->data, 0, sizeof(page->data));
+        page->seq.store(s + 1, std::memory_order_release);
+    }
+}
+
+inline void keepalive_status_publish(KeepaliveStatusPage* page, const KeepaliveStatusData& d) {
+    uint32_t s = page->seq.load(std::memory_order_relaxed);
+    page->seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&page->data, &d, sizeof(d));
+    page->seq.store(s + 2, std::memory_order_release);
+}
+
+// ===== 读端 =====
+// 写端正在写或读到一半被改写时重试；重试 max_spins 次仍失败返回 false
+inline bool keepalive_status_read(const KeepaliveStatusPage* page, KeepaliveStatusData& out, int max_spins = 1000) {
+    if (page->magic != KEEPALIVE_STATUS_MAGIC || page->version != KEEPALIVE_STATUS_VERSION ||
+        page->size != sizeof(KeepaliveStatusPage))
+        return false;
+    for (int i = 0; i < max_spins; i++) {
+        uint32_t s1 = page->seq.load(std::memory_order_acquire);
+        if (s1 & 1) continue;
+        memcpy(&out, (const void*)&page->data, sizeof(out));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint32_t s2 = page->seq.load(std::memory_order_relaxed);
+        if (s1 == s2) return true;
+    }
+    return false;
+}
+
+// ===== 映射 =====
+struct KeepaliveStatusMapping {
+    KeepaliveStatusPage* page;
+#ifdef _WIN32
+    HANDLE handle;
+    HANDLE writer_lock;             // 写端持有的命名互斥量
+#else
+    int fd;
+#endif
+};
+
+// writable=true 时 keepalive_log 自己用：打开或新建状态页并用 keepalive_status_adopt 接手。
+// 同一时刻只允许一个写端：Windows 上持有命名互斥量，POSIX 上对共享内存对象加 flock，
+// 两者都在写端进程退出（包括崩溃）时自动释放，所以只有还活着的写端会让第二个写端返回 false；
+// 崩溃留下的、或还被读者开着的状态页由下一个写端直接接手。Windows 的互斥量可重入，
+// 同一线程重复映射不算第二个写端。writable=false 只读打开已存在的状态页。
+inline bool keepalive_status_map(KeepaliveStatusMapping& m, bool writable) {
+    m.page = nullptr;
+#ifdef _WIN32
+    m.writer_lock = NULL;
+    if (writable) {
+        m.writer_lock = CreateMutexW(NULL, FALSE, KEEPALIVE_STATUS_WRITER_MUTEX);
+        if (!m.writer_lock) return false;
+        DWORD w = WaitForSingleObject(m.writer_lock, 0);
+        if (w != WAIT_OBJECT_0 && w != WAIT_ABANDONED) {
+            CloseHandle(m.writer_lock);
+            return false;
+        }
+        m.handle = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+                                      (DWORD)sizeof(KeepaliveStatusPage), KEEPALIVE_STATUS_SHM_NAME);
+    } else {
+        m.handle = OpenFileMappingW(FILE_MAP_READ, FALSE, KEEPALIVE_STATUS_SHM_NAME);
+    }
+    if (m.handle)
+        m.page = (KeepaliveStatusPage*)MapViewOfFile(m.handle, writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ,
+                                                     0, 0, sizeof(KeepaliveStatusPage));
+    if (!m.page) {
+        if (m.handle) CloseHandle(m.handle);
+        if (m.writer_lock) {
+            ReleaseMutex(m.writer_lock);
+            CloseHandle(m.writer_lock);
+        }
+        return false;
+    }
+#else
+    m.fd = shm_open(KEEPALIVE_STATUS_SHM_NAME, writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    if (m.fd < 0) return false;
+    if (writable && (flock(m.fd, LOCK_EX | LOCK_NB) != 0 || ftruncate(m.fd, sizeof(KeepaliveStatusPage)) != 0)) {
+        close(m.fd);
+        return false;
+    }
+    void* p = mmap(nullptr, sizeof(KeepaliveStatusPage), writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                   MAP_SHARED, m.fd, 0);
+    if (p == MAP_FAILED) {
+        close(m.fd);
+        return false;
+    }
+    m.page = (KeepaliveStatusPage*)p;
+#endif
+    if (writable) keepalive_status_adopt(m.page);
+    return true;
+}
+
+// 写端不删除状态页：一直开着视图的读者在 keepalive_log 重启后还能接着读
+inline void keepalive_status_unmap(KeepaliveStatusMapping& m) {
+    if (!m.page) return;
+#ifdef _WIN32
+    UnmapViewOfFile(m.page);
+    CloseHandle(m.handle);
+    if (m.writer_lock) {
+        ReleaseMutex(m.writer_lock);
+        CloseHandle(m.writer_lock);
+    }
+#else
+    munmap(m.page, sizeof(KeepaliveStatusPage));
+    close(m.fd);
+#endif
+    m.page = nullptr;
+}
+
+#endif
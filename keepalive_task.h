@@ -0,0 +1,360 @@
+// keepalive_task.h
+// 单线程协程执行器（C++20）。设备生命周期写成协程，在同一个线程上并发推进：
+// co_await 等待超时、设备就绪、重试间隔时不占线程，也不为每个设备开线程。
+// 时间一律由调用方传入（毫秒），Linux 上用虚拟时钟驱动，keepalive_log 主循环用 QPC 换算的 now_us() / 1000（见 exec_now）。
+// 只在一个线程上使用，不加锁。
+// co_await 的结果先存到变量再判断：GCC 12 对写在 if/while 条件里的 co_await 会生成错误代码。
+#ifndef KEEPALIVE_TASK_H
+#define KEEPALIVE_TASK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <coroutine>
+#include <exception>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "keepalive_timer.h"
+
+// ===== 协程帧复用 =====
+// 同一个协程函数的帧大小固定。释放的帧按大小挂回空闲链表，稳定状态下启动协程不做堆分配。
+// 帧不还给系统，占用由同时存活的协程数决定。
+class FramePool {
+public:
+    static void* alloc(size_t n) {
+        Bin* b = bin(n);
+        if (b && b->head) {
+            Free* f = b->head;
+            b->head = f->next;
+            return f;
+        }
+        return ::operator new(n);
+    }
+
+    static void release(void* p, size_t n) {
+        Bin* b = bin(n);
+        if (!b) {
+            ::operator delete(p);
+            return;
+        }
+        Free* f = (Free*)p;
+        f->next = b->head;
+        b->head = f;
+    }
+
+private:
+    struct Free {
+        Free* next;
+    };
+    struct Bin {
+        size_t size;
+        Free* head;
+    };
+    static const size_t BINS = 16;
+
+    static Bin* bin(size_t n) {
+        static thread_local Bin bins[BINS] = {};
+        for (size_t i = 0; i < BINS; i++) {
+            if (bins[i].size == n) return &bins[i];
+            if (bins[i].size == 0) {
+                bins[i].size = n;
+                return &bins[i];
+            }
+        }
+        return nullptr;   // 大小种类太多时退回普通分配
+    }
+};
+
+// ===== Task =====
+// 惰性启动：co_await 时才开始执行，结束后回到等待它的协程。交给 Executor::spawn 的
+// 顶层协程没有等待者，结束时自己销毁。协程内不抛异常，抛出即 terminate。
+template <typename T = void>
+class Task;
+
+namespace task_detail {
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation;
+    int* live = nullptr;   // spawn 出来的协程：结束时减一
+
+    static void* operator new(size_t n) { return FramePool::alloc(n); }
+    static void operator delete(void* p, size_t n) { FramePool::release(p, n); }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    void unhandled_exception() { std::terminate(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    T value{};
+    void return_value(T v) { value = std::move(v); }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    void return_void() {}
+};
+
+}  // namespace task_detail
+
+template <typename T>
+class Task {
+public:
+    struct promise_type : task_detail::Promise<T> {
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+        struct Final {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                std::coroutine_handle<> next = h.promise().continuation;
+                if (h.promise().live) {
+                    (*h.promise().live)--;
+                    h.destroy();
+                    return std::noop_coroutine();
+                }
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        Final final_suspend() noexcept { return {}; }
+    };
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    Task(Task&& o) noexcept : h_(o.h_) { o.h_ = nullptr; }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (h_) h_.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) noexcept {
+        h_.promise().continuation = cont;
+        return h_;
+    }
+    T await_resume() {
+        if constexpr (!std::is_void_v<T>) return std::move(h_.promise().value);
+    }
+
+    // 交出所有权，由协程结束时自己销毁；live 在结束时减一
+    Handle detach(int* live) {
+        Handle h = h_;
+        h_ = nullptr;
+        h.promise().live = live;
+        return h;
+    }
+
+private:
+    explicit Task(Handle h) : h_(h) {}
+    Handle h_;
+};
+
+// ===== 等待节点 =====
+// 挂起中的协程在帧里放一个 Waiter，同时挂在时间轮、Signal 链表和取消源链表上，
+// 哪一方先触发就从其余两处摘下并放进就绪队列。全是侵入式结构，挂起/唤醒不做堆分配。
+enum WakeReason {
+    WAKE_SIGNALED = 0,
+    WAKE_TIMEOUT = 1,
+    WAKE_CANCELLED = 2
+};
+
+static const int64_t TASK_NO_DEADLINE = TIMER_NEVER;
+
+class Executor;
+class Signal;
+class CancelSource;
+
+struct Waiter : TimerNode {   // 同一时刻到期的按挂起顺序唤醒
+    std::coroutine_handle<> h;
+    Signal* signal = nullptr;
+    Waiter* sig_prev = nullptr;
+    Waiter* sig_next = nullptr;
+    CancelSource* cancel = nullptr;
+    Waiter* cancel_prev = nullptr;
+    Waiter* cancel_next = nullptr;
+    WakeReason reason = WAKE_SIGNALED;
+};
+
+// 侵入式双向链表头，Signal 和 CancelSource 共用
+template <Waiter* Waiter::*Prev, Waiter* Waiter::*Next>
+struct WaiterList {
+    Waiter* head = nullptr;
+
+    void push(Waiter* w) {
+        w->*Prev = nullptr;
+        w->*Next = head;
+        if (head) head->*Prev = w;
+        head = w;
+    }
+    void remove(Waiter* w) {
+        if (w->*Prev) (w->*Prev)->*Next = w->*Next;
+        else head = w->*Next;
+        if (w->*Next) (w->*Next)->*Prev = w->*Prev;
+        w->*Prev = w->*Next = nullptr;
+    }
+};
+
+// ===== 取消 =====
+// 一个取消源对应一段可以被取代的工作（例如“当前默认设备的播放生命周期”）。cancel() 让代数加一，
+// 唤醒所有用旧代数令牌挂起的协程（结果为 WAKE_CANCELLED），之后发出的令牌重新有效。
+class CancelSource {
+public:
+    uint64_t generation() const { return gen_; }
+
+private:
+    friend class Executor;
+    friend class CancelToken;
+    uint64_t gen_ = 0;
+    WaiterList<&Waiter::cancel_prev, &Waiter::cancel_next> waiters_;
+};
+
+class CancelToken {
+public:
+    CancelToken() {}
+    explicit CancelToken(const CancelSource& s) : src_(&s), gen_(s.gen_) {}
+
+    bool cancelled() const { return src_ && src_->gen_ != gen_; }
+    CancelSource* source() const { return const_cast<CancelSource*>(src_); }
+
+private:
+    const CancelSource* src_ = nullptr;
+    uint64_t gen_ = 0;
+};
+
+// ===== Signal =====
+// 条件变量式的通知：notify() 唤醒当前所有等待者，不记忆。等待方被唤醒后自己重新检查条件。
+class Signal {
+public:
+    bool has_waiters() const { return waiters_.head != nullptr; }
+
+private:
+    friend class Executor;
+    WaiterList<&Waiter::sig_prev, &Waiter::sig_next> waiters_;
+};
+
+// ===== 执行器 =====
+class Executor {
+public:
+    // 顶层协程：放进就绪队列，下一次 run() 开始执行
+    void spawn(Task<void> t) {
+        ready_.push_back(t.detach(&live_));
+        live_++;
+    }
+
+    // 推进到 now_ms：到期的等待先超时唤醒，再把就绪队列跑空（运行中新就绪的协程也在本次运行）。
+    // 返回恢复执行的次数。
+    size_t run(int64_t now_ms) {
+        if (now_ms > now_) now_ = now_ms;
+        wheel_.advance(now_, [this](TimerNode* n) { wake(static_cast<Waiter*>(n), WAKE_TIMEOUT); });
+        size_t n = 0;
+        for (size_t i = 0; i < ready_.size(); i++, n++) {
+            std::coroutine_handle<> h = ready_[i];
+            h.resume();
+        }
+        ready_.clear();
+        resumes_ += n;
+        return n;
+    }
+
+    int64_t now() const { return now_; }
+    bool has_ready() const { return !ready_.empty(); }
+    // 最早的等待到期时间，没有等待中的定时器返回 TASK_NO_DEADLINE
+    int64_t next_deadline() { return wheel_.next_deadline(); }
+    int live() const { return live_; }
+    size_t timers() const { return wheel_.size(); }
+    uint64_t resumes() const { return resumes_; }
+
+    void notify(Signal& s) {
+        while (s.waiters_.head) wake(s.waiters_.head, WAKE_SIGNALED);
+    }
+
+    void cancel(CancelSource& c) {
+        c.gen_++;
+        while (c.waiters_.head) wake(c.waiters_.head, WAKE_CANCELLED);
+    }
+
+    // co_await ex.sleep(ms, tok)：睡满返回 true，被取消返回 false
+    struct SleepAwaiter {
+        Executor* ex;
+        int64_t deadline;
+        CancelToken tok;
+        Waiter w;
+
+        bool await_ready() const { return tok.cancelled() || deadline <= ex->now_; }
+        void await_suspend(std::coroutine_handle<> h) { ex->suspend(w, h, nullptr, deadline, tok); }
+        bool await_resume() const { return !tok.cancelled(); }
+    };
+    SleepAwaiter sleep(int64_t ms, CancelToken tok = CancelToken()) { return SleepAwaiter{ this, now_ + ms, tok, Waiter() }; }
+
+    // co_await ex.wait(signal, deadline_ms, tok)：返回唤醒原因
+    struct WaitAwaiter {
+        Executor* ex;
+        Signal* sig;
+        int64_t deadline;
+        CancelToken tok;
+        Waiter w;
+
+        bool await_ready() {
+            if (tok.cancelled()) w.reason = WAKE_CANCELLED;
+            else if (deadline <= ex->now_) w.reason = WAKE_TIMEOUT;
+            else return false;
+            return true;
+        }
+        void await_suspend(std::coroutine_handle<> h) { ex->suspend(w, h, sig, deadline, tok); }
+        WakeReason await_resume() const { return w.reason; }
+    };
+    WaitAwaiter wait(Signal& s, int64_t deadline_ms, CancelToken tok = CancelToken()) {
+        return WaitAwaiter{ this, &s, deadline_ms, tok, Waiter() };
+    }
+
+private:
+    void suspend(Waiter& w, std::coroutine_handle<> h, Signal* s, int64_t deadline, const CancelToken& tok) {
+        w.h = h;
+        if (s) {
+            w.signal = s;
+            s->waiters_.push(&w);
+        }
+        if (tok.source()) {
+            w.cancel = tok.source();
+            w.cancel->waiters_.push(&w);
+        }
+        if (deadline != TASK_NO_DEADLINE) wheel_.add(&w, deadline);
+    }
+
+    void wake(Waiter* w, WakeReason reason) {
+        if (w->signal) {
+            w->signal->waiters_.remove(w);
+            w->signal = nullptr;
+        }
+        if (w->cancel) {
+            w->cancel->waiters_.remove(w);
+            w->cancel = nullptr;
+        }
+        wheel_.remove(w);
+        w->reason = reason;
+        ready_.push_back(w->h);
+    }
+
+    int64_t now_ = 0;
+    uint64_t resumes_ = 0;
+    int live_ = 0;
+    std::vector<std::coroutine_handle<>> ready_;
+    TimerWheel wheel_;
+};
+
+// ===== 组合等待 =====
+// 等到 ready() 为真：每次 Signal 通知后重新检查，总共最多等 timeout_ms。
+// 条件满足返回 true，超时或被取消返回 false。timeout_ms 为 TASK_NO_DEADLINE 时不超时。
+template <typename Pred>
+Task<bool> wait_until(Executor& ex, Signal& s, Pred ready, int64_t timeout_ms, CancelToken tok = CancelToken()) {
+    int64_t deadline = timeout_ms == TASK_NO_DEADLINE ? TASK_NO_DEADLINE : ex.now() + timeout_ms;
+    while (!ready()) {
+        WakeReason r = co_await ex.wait(s, deadline, tok);
+        if (r != WAKE_SIGNALED) co_return ready() && !tok.cancelled();
+    }
+    co_return !tok.cancelled();
+}
+
+#endif
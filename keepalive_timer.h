@@ -0,0 +1,244 @@
+// keepalive_timer.h
+// 分层时间轮，不依赖 Windows。精度 1 ms，6 层 × 64 槽覆盖 2^36 ms（约两年），更远的放溢出链表。
+// 插入、取消 O(1)；推进时跳过空槽，长时间空闲后一次推进也只看有定时器的槽。
+// 节点侵入式地挂在槽链表上，增删不做堆分配。只在一个线程上使用。
+#ifndef KEEPALIVE_TIMER_H
+#define KEEPALIVE_TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+static const int64_t TIMER_NEVER = INT64_MAX;
+
+struct TimerNode {
+    int64_t deadline = TIMER_NEVER;
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+    struct TimerSlot* slot = nullptr;   // 不在时间轮上时为空
+};
+
+// min 是槽里最早的 deadline；摘掉的正好是最早的那个时只做标记，下次要用时再扫一遍这个槽
+struct TimerSlot {
+    TimerNode* head = nullptr;
+    TimerNode* tail = nullptr;
+    int64_t min = TIMER_NEVER;
+    bool min_stale = false;
+};
+
+class TimerWheel {
+public:
+    static const int LEVEL_BITS = 6;
+    static const int SLOTS = 1 << LEVEL_BITS;
+    static const int LEVELS = 6;
+
+    explicit TimerWheel(int64_t now_ms = 0) : cur_(now_ms) {}
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    int64_t now() const { return cur_; }
+
+    // 同一时刻到期的节点按插入顺序触发。已经过期的 deadline 在下一次 advance() 时触发。
+    void add(TimerNode* n, int64_t deadline) {
+        if (n->slot) remove(n);
+        n->deadline = deadline;
+        place(n);
+        size_++;
+        if (deadline < next_) next_ = deadline;
+    }
+
+    void remove(TimerNode* n) {
+        if (!n->slot) return;
+        unlink(n);
+        size_--;
+        if (n->deadline <= next_) next_dirty_ = true;
+    }
+
+    // 推进到 now_ms，对每个到期节点调用 fire(node)。回调前节点已摘下，回调里可以再加/删定时器。
+    // 返回触发的个数。
+    template <typename F>
+    size_t advance(int64_t now_ms, F fire) {
+        size_t fired = 0;
+        fired += fire_list(due(), fire);
+        while (true) {
+            int64_t t = next_stop();
+            if (t > now_ms) break;
+            cur_ = t;
+            cascade();
+            fired += fire_list(slot(0, (int)(cur_ & (SLOTS - 1))), fire);
+            fired += fire_list(due(), fire);   // 回调里加的已过期定时器
+            cur_ = t + 1;
+        }
+        if (now_ms + 1 > cur_) cur_ = now_ms + 1;
+        next_dirty_ = true;
+        return fired;
+    }
+
+    // 最早的到期时间（精确值），没有定时器返回 TIMER_NEVER
+    int64_t next_deadline() {
+        if (!next_dirty_) return next_;
+        int64_t best = TIMER_NEVER;
+        if (due().head) best = min_in(due(), best);
+        for (int l = 0; l < LEVELS; l++) {
+            int s = first_slot(l);
+            if (s >= 0) best = min_in(slot(l, s), best);
+        }
+        if (overflow().head) best = min_in(overflow(), best);
+        next_ = best;
+        next_dirty_ = false;
+        return best;
+    }
+
+private:
+    TimerSlot& slot(int level, int s) { return slots_[level * SLOTS + s]; }
+    TimerSlot& due() { return slots_[LEVELS * SLOTS]; }
+    TimerSlot& overflow() { return slots_[LEVELS * SLOTS + 1]; }
+    const TimerSlot& overflow() const { return slots_[LEVELS * SLOTS + 1]; }
+
+    static int64_t min_in(TimerSlot& s, int64_t best) {
+        if (s.min_stale) {
+            s.min = TIMER_NEVER;
+            for (TimerNode* n = s.head; n; n = n->next)
+                if (n->deadline < s.min) s.min = n->deadline;
+            s.min_stale = false;
+        }
+        return s.min < best ? s.min : best;
+    }
+
+    // v 非零；de Bruijn 乘法查表，MSVC 和 GCC 上都不依赖内建函数
+    static int lowest_bit(uint64_t v) {
+        static const int table[64] = {
+            0, 1, 2, 53, 3, 7, 54, 27, 4, 38, 41, 8, 34, 55, 48, 28,
+            62, 5, 39, 46, 44, 42, 22, 9, 24, 35, 59, 56, 49, 18, 29, 11,
+            63, 52, 6, 26, 37, 40, 33, 47, 61, 45, 43, 21, 23, 58, 17, 10,
+            51, 25, 36, 32, 60, 20, 57, 16, 50, 31, 19, 15, 30, 14, 13, 12
+        };
+        return table[((v & (0 - v)) * 0x022FDD63CC95386Dull) >> 58];
+    }
+
+    // 层号由 deadline 与当前时间最高的不同位决定：第 l 层的节点与当前时间在 l 层以上的位都相同，
+    // 所以同一层的槽按时间先后排列，当前时间走到槽起点时整槽下放一层（cascade）。
+    void place(TimerNode* n) {
+        if (n->deadline < cur_) {
+            push(due(), n);
+            return;
+        }
+        uint64_t diff = (uint64_t)(n->deadline ^ cur_);
+        int level = 0;
+        while (level < LEVELS && diff >> ((level + 1) * LEVEL_BITS)) level++;
+        if (level >= LEVELS) {
+            push(overflow(), n);
+            return;
+        }
+        int s = (int)((n->deadline >> (level * LEVEL_BITS)) & (SLOTS - 1));
+        push(slot(level, s), n);
+        bitmap_[level] |= 1ull << s;
+    }
+
+    void push(TimerSlot& s, TimerNode* n) {
+        n->slot = &s;
+        n->next = nullptr;
+        n->prev = s.tail;
+        if (s.tail) s.tail->next = n;
+        else s.head = n;
+        s.tail = n;
+        if (n->deadline < s.min) s.min = n->deadline;
+    }
+
+    void unlink(TimerNode* n) {
+        TimerSlot& s = *n->slot;
+        if (n->prev) n->prev->next = n->next;
+        else s.head = n->next;
+        if (n->next) n->next->prev = n->prev;
+        else s.tail = n->prev;
+        n->prev = n->next = nullptr;
+        n->slot = nullptr;
+        if (!s.head) {
+            s.min = TIMER_NEVER;
+            s.min_stale = false;
+            clear_bit(&s);
+        } else if (n->deadline == s.min) {
+            s.min_stale = true;
+        }
+    }
+
+    void clear_bit(const TimerSlot* s) {
+        size_t i = (size_t)(s - &slots_[0]);
+        if (i < LEVELS * SLOTS) bitmap_[i / SLOTS] &= ~(1ull << (i % SLOTS));
+    }
+
+    // 第 l 层当前位置及之后第一个有节点的槽，没有返回 -1
+    int first_slot(int l) const {
+        int idx = (int)((cur_ >> (l * LEVEL_BITS)) & (SLOTS - 1));
+        uint64_t m = bitmap_[l] & (~0ull << idx);
+        return m ? lowest_bit(m) : -1;
+    }
+
+    // 下一个需要处理的时间：第 0 层的到期时刻或更高层槽的起点（在那里下放）
+    int64_t next_stop() const {
+        int64_t best = TIMER_NEVER;
+        for (int l = 0; l < LEVELS; l++) {
+            int s = first_slot(l);
+            if (s < 0) continue;
+            int shift = l * LEVEL_BITS;
+            int64_t base = cur_ & ~(((int64_t)1 << (shift + LEVEL_BITS)) - 1);
+            int64_t t = base + ((int64_t)s << shift);
+            if (t < cur_) t = cur_;
+            if (t < best) best = t;
+        }
+        if (overflow().head) {
+            int64_t span = (int64_t)1 << (LEVELS * LEVEL_BITS);
+            int64_t t = (cur_ & ~(span - 1)) + span;
+            if (t < best) best = t;
+        }
+        return best;
+    }
+
+    // 当前时间正好是某层槽的起点：从高到低把该槽的节点按新的当前时间重新放置
+    void cascade() {
+        if (overflow().head && (cur_ & (((int64_t)1 << (LEVELS * LEVEL_BITS)) - 1)) == 0) relocate(overflow());
+        for (int l = LEVELS - 1; l >= 1; l--) {
+            int shift = l * LEVEL_BITS;
+            if (cur_ & (((int64_t)1 << shift) - 1)) continue;
+            int s = (int)((cur_ >> shift) & (SLOTS - 1));
+            if (bitmap_[l] >> s & 1) relocate(slot(l, s));
+        }
+    }
+
+    void relocate(TimerSlot& s) {
+        TimerNode* n = s.head;
+        s.head = s.tail = nullptr;
+        s.min = TIMER_NEVER;
+        s.min_stale = false;
+        clear_bit(&s);
+        while (n) {
+            TimerNode* next = n->next;
+            place(n);
+            n = next;
+        }
+    }
+
+    template <typename F>
+    size_t fire_list(TimerSlot& s, F& fire) {
+        size_t fired = 0;
+        while (s.head) {
+            TimerNode* n = s.head;
+            unlink(n);
+            size_--;
+            fired++;
+            fire(n);
+        }
+        return fired;
+    }
+
+    int64_t cur_;
+    size_t size_ = 0;
+    int64_t next_ = TIMER_NEVER;
+    bool next_dirty_ = false;
+    uint64_t bitmap_[LEVELS] = {};
+    // 各层的槽连续存放，最后两个是已过期和溢出链表，clear_bit() 靠下标区分
+    TimerSlot slots_[LEVELS * SLOTS + 2];
+};
+
+#endif
@@ -0,0 +1,279 @@
+// keepalive_util.h
+// 不依赖 Windows 的字符串/配置辅助函数，keepalive_log.cpp、keepalive_bench.cpp 与 keepalive_sim.cpp 共用
+#ifndef KEEPALIVE_UTIL_H
+#define KEEPALIVE_UTIL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+
+// ===== 码点写入 =====
+// Windows 上 wchar_t 是 UTF-16，需要拆代理对；其他平台是 UTF-32
+inline void append_codepoint(std::wstring& out, uint32_t cp) {
+    if (sizeof(wchar_t) == 2 && cp >= 0x10000) {
+        cp -= 0x10000;
+        out.push_back((wchar_t)(0xD800 + (cp >> 10)));
+        out.push_back((wchar_t)(0xDC00 + (cp & 0x3FF)));
+    } else {
+        out.push_back((wchar_t)cp);
+    }
+}
+
+// ===== UTF-8 → Wide =====
+// 非法序列按字节替换为 U+FFFD，与 MultiByteToWideChar 的默认行为一致
+inline std::wstring utf8_to_wstring(const std::string& s) {
+    static const uint32_t min_cp[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+    std::wstring out;
+    out.reserve(s.size());
+    size_t i = 0, n = s.size();
+    while (i < n) {
+        unsigned char c = (unsigned char)s[i];
+        if (c < 0x80) {
+            out.push_back((wchar_t)c);
+            i++;
+            continue;
+        }
+        int len;
+        uint32_t cp;
+        if ((c & 0xE0) == 0xC0) { len = 2; cp = c & 0x1F; }
+        else if ((c & 0xF0) == 0xE0) { len = 3; cp = c & 0x0F; }
+        else if ((c & 0xF8) == 0xF0) { len = 4; cp = c & 0x07; }
+        else { out.push_back((wchar_t)0xFFFD); i++; continue; }
+
+        bool ok = i + len <= n;
+        for (int k = 1; ok && k < len; k++) {
+            unsigned char cc = (unsigned char)s[i + k];
+            if ((cc & 0xC0) != 0x80) ok = false;
+            else cp = (cp << 6) | (cc & 0x3F);
+        }
+        if (!ok || cp < min_cp[len] || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+            out.push_back((wchar_t)0xFFFD);
+            i++;
+            continue;
+        }
+        append_codepoint(out, cp);
+        i += len;
+    }
+    return out;
+}
+
+// ===== Wide → UTF-8（追加）=====
+// 落单的代理项写成 U+FFFD
+inline void append_utf8(std::string& out, const wchar_t* w, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        uint32_t cp = (uint32_t)w[i];
+        if (cp < 0x80) {
+            out.push_back((char)cp);
+            continue;
+        }
+        if (sizeof(wchar_t) == 2 && cp >= 0xD800 && cp <= 0xDFFF) {
+            if (cp <= 0xDBFF && i + 1 < n && (uint32_t)w[i + 1] >= 0xDC00 && (uint32_t)w[i + 1] <= 0xDFFF) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + ((uint32_t)w[i + 1] - 0xDC00);
+                i++;
+            } else {
+                cp = 0xFFFD;
+            }
+        }
+        if (cp > 0x10FFFF) cp = 0xFFFD;
+        if (cp < 0x800) {
+            out.push_back((char)(0xC0 | (cp >> 6)));
+        } else if (cp < 0x10000) {
+            out.push_back((char)(0xE0 | (cp >> 12)));
+            out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+        } else {
+            out.push_back((char)(0xF0 | (cp >> 18)));
+            out.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+        }
+        out.push_back((char)(0x80 | (cp & 0x3F)));
+    }
+}
+
+inline void append_utf8(std::string& out, const std::wstring& w) {
+    append_utf8(out, w.c_str(), w.size());
+}
+
+// ===== 读取配置行 =====
+// UTF-8（可带 BOM），每行去掉首尾空白，空行跳过
+inline std::vector<std::string> read_config_lines(const char* filename) {
+    std::vector<std::string> list;
+    std::ifstream fin(filename, std::ios::binary);
+    if (!fin.is_open()) return list;
+
+    std::ostringstream ss;
+    ss << fin.rdbuf();
+    std::string all = ss.str();
+    fin.close();
+
+    if (all.size() >= 3 && (unsigned char)all[0] == 0xEF &&
+        (unsigned char)all[1] == 0xBB && (unsigned char)all[2] == 0xBF)
+        all = all.substr(3);
+
+    std::istringstream lines(all);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        size_t s = line.find_first_not_of(" \t");
+        size_t e = line.find_last_not_of(" \t");
+        if (s != std::string::npos)
+            list.push_back(line.substr(s, e - s + 1));
+    }
+    return list;
+}
+
+// ===== 读取阻止设备列表 =====
+inline std::vector<std::wstring> read_blocked_devices(const char* filename) {
+    std::vector<std::wstring> list;
+    for (const auto& line : read_config_lines(filename)) list.push_back(utf8_to_wstring(line));
+    return list;
+}
+
+// ===== 判断设备是否被阻止 =====
+inline bool is_blocked_device(const wchar_t* name, const std::vector<std::wstring>& blocked) {
+    for (const auto& b : blocked) {
+        if (wcsstr(name, b.c_str())) return true;
+    }
+    return false;
+}
+
+// ===== 读取间歇保活设备列表 =====
+// 每行 “设备名=空闲超时秒数” 或 “设备名=空闲超时秒数,burst 毫秒数”，设备名与阻止列表一样按子串匹配，
+// 例如 ABCDEF=30 或 ABCDEF=30,500。超时写 auto 表示不知道，由程序自己学（ABCDEF=auto）。
+// 格式不对的行跳过，计入 skipped。
+struct DutyCycleDevice {
+    std::wstring name;
+    int64_t idle_timeout_ms;   // 0 表示 auto
+    int64_t burst_ms;   // 0 表示用默认长度
+};
+
+inline bool parse_duty_cycle_device(const std::string& line, DutyCycleDevice& out) {
+    size_t eq = line.rfind('=');
+    if (eq == std::string::npos || eq == 0) return false;
+    size_t e = line.find_last_not_of(" \t", eq - 1);
+    const char* p = line.c_str() + eq + 1;
+    while (*p == ' ' || *p == '\t') p++;
+    char* end = nullptr;
+    long long timeout_s = 0;
+    if (strncmp(p, "auto", 4) == 0) {
+        end = const_cast<char*>(p) + 4;
+    } else {
+        timeout_s = strtoll(p, &end, 10);
+        if (end == p || timeout_s <= 0) return false;
+    }
+    long long burst_ms = 0;
+    while (*end == ' ' || *end == '\t') end++;
+    if (*end == ',') {
+        p = end + 1;
+        burst_ms = strtoll(p, &end, 10);
+        if (end == p || burst_ms <= 0) return false;
+        while (*end == ' ' || *end == '\t') end++;
+    }
+    if (*end) return false;
+    out.name = utf8_to_wstring(line.substr(0, e + 1));
+    out.idle_timeout_ms = (int64_t)timeout_s * 1000;
+    out.burst_ms = (int64_t)burst_ms;
+    return true;
+}
+
+inline std::vector<DutyCycleDevice> read_duty_cycle_devices(const char* filename, size_t* skipped = nullptr) {
+    std::vector<DutyCycleDevice> list;
+    if (skipped) *skipped = 0;
+    for (const auto& line : read_config_lines(filename)) {
+        DutyCycleDevice d;
+        if (parse_duty_cycle_device(line, d)) list.push_back(d);
+        else if (skipped) (*skipped)++;
+    }
+    return list;
+}
+
+// 第一个匹配的条目，没有返回 nullptr
+inline const DutyCycleDevice* find_duty_cycle_device(const wchar_t* name, const std::vector<DutyCycleDevice>& list) {
+    for (const auto& d : list) {
+        if (wcsstr(name, d.name.c_str())) return &d;
+    }
+    return nullptr;
+}
+
+// ===== 时间戳 =====
+// 格式 "[YYYY/MM/DD - HH:MM:SS] "，手工写数字，不走 swprintf
+struct LogTimestamp {
+    int year, month, day, hour, minute, second;
+};
+
+static const size_t LOG_TIMESTAMP_LEN = 24;
+
+inline void put_digits(wchar_t* p, int v, int width) {
+    for (int i = width - 1; i >= 0; i--) {
+        p[i] = (wchar_t)(L'0' + v % 10);
+        v /= 10;
+    }
+}
+
+// buf 至少 LOG_TIMESTAMP_LEN + 1 个字符
+inline size_t format_log_timestamp(wchar_t* buf, const LogTimestamp& t) {
+    wmemcpy(buf, L"[0000/00/00 - 00:00:00] ", LOG_TIMESTAMP_LEN + 1);
+    put_digits(buf + 1, t.year, 4);
+    put_digits(buf + 6, t.month, 2);
+    put_digits(buf + 9, t.day, 2);
+    put_digits(buf + 14, t.hour, 2);
+    put_digits(buf + 17, t.minute, 2);
+    put_digits(buf + 20, t.second, 2);
+    return LOG_TIMESTAMP_LEN;
+}
+
+// ===== 定长字符串 =====
+// 内容放在对象内部，超出容量的部分截断。稳态路径上拼日志用，不做堆分配。
+template <size_t N>
+class InlineWString {
+public:
+    InlineWString() { buf_[0] = 0; }
+    explicit InlineWString(const wchar_t* s) {
+        buf_[0] = 0;
+        append(s);
+    }
+
+    InlineWString& append(const wchar_t* s, size_t n) {
+        if (n > N - 1 - len_) n = N - 1 - len_;
+        wmemcpy(buf_ + len_, s, n);
+        len_ += n;
+        buf_[len_] = 0;
+        return *this;
+    }
+    InlineWString& append(const wchar_t* s) { return s ? append(s, wcslen(s)) : *this; }
+    InlineWString& append_uint(uint64_t v) {
+        wchar_t tmp[20];
+        size_t n = 0;
+        do {
+            tmp[n++] = (wchar_t)(L'0' + v % 10);
+            v /= 10;
+        } while (v);
+        while (n > 0 && len_ < N - 1) buf_[len_++] = tmp[--n];
+        buf_[len_] = 0;
+        return *this;
+    }
+    InlineWString& operator<<(const wchar_t* s) { return append(s); }
+    InlineWString& operator<<(uint64_t v) { return append_uint(v); }
+
+    void clear() {
+        len_ = 0;
+        buf_[0] = 0;
+    }
+    const wchar_t* c_str() const { return buf_; }
+    size_t size() const { return len_; }
+    bool operator==(const wchar_t* s) const { return wcscmp(buf_, s) == 0; }
+
+private:
+    wchar_t buf_[N];
+    size_t len_ = 0;
+};
+
+// 一条日志（含时间戳）的最大长度，更长的截断
+static const size_t LOG_LINE_MAX = 512;
+typedef InlineWString<LOG_LINE_MAX> LogText;
+
+#endif